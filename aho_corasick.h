@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Aho-Corasick multi pattern matcher, compiled into a DFA so searching is a single table lookup per byte no matter
+// how many patterns there are. https://en.wikipedia.org/wiki/Aho%E2%80%93Corasick_algorithm
+// Bytes that don't occur in any pattern share one column of the transition table, which keeps the table small for
+// patterns that only use a handful of distinct characters such as identifiers.
+
+#define AHO_CORASICK_OUTPUT 0x80000000u
+
+typedef struct
+{
+	uint8_t classes[256];
+	uint32_t num_classes;
+	uint32_t num_states;
+	// Row offset (state * num_classes) of the next state, AHO_CORASICK_OUTPUT is set when a pattern ends there.
+	uint32_t *transitions;
+	int32_t *pattern;	// Pattern that ends in this state, -1 if none
+	uint32_t *suffix;	// Next state on the failure chain that has a pattern, 0 if none
+	uint32_t *lengths;	// Pattern lengths
+	uint32_t num_patterns;
+} AhoCorasick;
+
+// Called for every occurrence, including overlapping ones. Returning false stops the search.
+typedef bool (*AhoCorasickMatch)(void *ctx, size_t offset, uint32_t pattern);
+
+static uint32_t aho_corasick_add_state_(AhoCorasick *ac, uint32_t *capacity)
+{
+	if(ac->num_states == *capacity)
+	{
+		*capacity *= 2;
+		ac->transitions = realloc(ac->transitions, (size_t)*capacity * ac->num_classes * sizeof(uint32_t));
+		ac->pattern = realloc(ac->pattern, *capacity * sizeof(int32_t));
+	}
+	uint32_t state = ac->num_states++;
+	memset(&ac->transitions[(size_t)state * ac->num_classes], 0, ac->num_classes * sizeof(uint32_t));
+	ac->pattern[state] = -1;
+	return state;
+}
+
+static void aho_corasick_build(AhoCorasick *ac, const char **patterns, const size_t *lengths, uint32_t num_patterns)
+{
+	memset(ac, 0, sizeof(AhoCorasick));
+	ac->num_classes = 1; // 0 is every byte that isn't part of a pattern
+	for(uint32_t i = 0; i < num_patterns; ++i)
+	{
+		for(size_t j = 0; j < lengths[i]; ++j)
+		{
+			uint8_t ch = patterns[i][j];
+			if(!ac->classes[ch])
+				ac->classes[ch] = ac->num_classes++;
+		}
+	}
+
+	// Trie, 0 means there's no edge yet. The root is state 0 and can never be a child.
+	uint32_t capacity = 64;
+	ac->transitions = malloc((size_t)capacity * ac->num_classes * sizeof(uint32_t));
+	ac->pattern = malloc(capacity * sizeof(int32_t));
+	ac->lengths = malloc((num_patterns ? num_patterns : 1) * sizeof(uint32_t));
+	ac->num_patterns = num_patterns;
+	aho_corasick_add_state_(ac, &capacity);
+	for(uint32_t i = 0; i < num_patterns; ++i)
+	{
+		uint32_t state = 0;
+		for(size_t j = 0; j < lengths[i]; ++j)
+		{
+			size_t edge = (size_t)state * ac->num_classes + ac->classes[(uint8_t)patterns[i][j]];
+			if(!ac->transitions[edge])
+			{
+				uint32_t child = aho_corasick_add_state_(ac, &capacity);
+				edge = (size_t)state * ac->num_classes + ac->classes[(uint8_t)patterns[i][j]];
+				ac->transitions[edge] = child;
+			}
+			state = ac->transitions[edge];
+		}
+		if(ac->pattern[state] == -1)
+			ac->pattern[state] = i;
+		ac->lengths[i] = lengths[i];
+	}
+
+	// Breadth first, every missing edge becomes the edge of the failure state which is always closer to the root.
+	uint32_t *fail = calloc(ac->num_states, sizeof(uint32_t));
+	uint32_t *queue = malloc(ac->num_states * sizeof(uint32_t));
+	ac->suffix = calloc(ac->num_states, sizeof(uint32_t));
+	size_t head = 0, tail = 0;
+	queue[tail++] = 0;
+	while(head < tail)
+	{
+		uint32_t state = queue[head++];
+		uint32_t *row = &ac->transitions[(size_t)state * ac->num_classes];
+		uint32_t *fail_row = &ac->transitions[(size_t)fail[state] * ac->num_classes];
+		for(uint32_t c = 0; c < ac->num_classes; ++c)
+		{
+			uint32_t child = row[c];
+			if(child)
+			{
+				fail[child] = state == 0 ? 0 : fail_row[c];
+				ac->suffix[child] = ac->pattern[fail[child]] != -1 ? fail[child] : ac->suffix[fail[child]];
+				queue[tail++] = child;
+			}
+			else
+			{
+				row[c] = state == 0 ? 0 : fail_row[c];
+			}
+		}
+	}
+	free(queue);
+	free(fail);
+
+	// Store row offsets instead of state indices and flag states that report a match.
+	for(size_t i = 0; i < (size_t)ac->num_states * ac->num_classes; ++i)
+	{
+		uint32_t target = ac->transitions[i];
+		uint32_t value = target * ac->num_classes;
+		if(ac->pattern[target] != -1 || ac->suffix[target])
+			value |= AHO_CORASICK_OUTPUT;
+		ac->transitions[i] = value;
+	}
+}
+
+static void aho_corasick_free(AhoCorasick *ac)
+{
+	free(ac->transitions);
+	free(ac->pattern);
+	free(ac->suffix);
+	free(ac->lengths);
+	memset(ac, 0, sizeof(AhoCorasick));
+}
+
+// Reports the offset at which each occurrence starts, in order of where they end.
+static void aho_corasick_search(const AhoCorasick *ac, const uint8_t *data, size_t size, AhoCorasickMatch match, void *ctx)
+{
+	const uint32_t *transitions = ac->transitions;
+	const uint8_t *classes = ac->classes;
+	uint32_t row = 0;
+	for(size_t i = 0; i < size; ++i)
+	{
+		uint32_t next = transitions[row + classes[data[i]]];
+		row = next & ~AHO_CORASICK_OUTPUT;
+		if(!(next & AHO_CORASICK_OUTPUT))
+			continue;
+		for(uint32_t state = row / ac->num_classes; state; state = ac->suffix[state])
+		{
+			int32_t pattern = ac->pattern[state];
+			if(pattern == -1)
+				continue;
+			if(!match(ctx, i + 1 - ac->lengths[pattern], pattern))
+				return;
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Bump allocator. Memory is handed out from large blocks and only given back all at once with arena_reset. An arena
+// that's reset for every file settles on one block that's big enough and stops allocating.
+
+typedef struct ArenaBlock_s
+{
+	struct ArenaBlock_s *next;
+	size_t size;
+	size_t used;
+} ArenaBlock;
+
+typedef struct
+{
+	ArenaBlock *blocks; // Newest first
+	size_t block_size;
+} Arena;
+
+static void arena_init(Arena *a, size_t block_size)
+{
+	a->blocks = NULL;
+	a->block_size = block_size;
+}
+
+static void *arena_alloc(Arena *a, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	ArenaBlock *b = a->blocks;
+	if(!b || b->size - b->used < size)
+	{
+		size_t block_size = size > a->block_size ? size : a->block_size;
+		b = malloc(sizeof(ArenaBlock) + 16 + block_size);
+		if(!b)
+			return NULL;
+		b->size = block_size;
+		b->used = 0;
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+	uint8_t *base = (uint8_t *)(((uintptr_t)(b + 1) + 15) & ~(uintptr_t)15);
+	void *p = base + b->used;
+	b->used += size;
+	return p;
+}
+
+static void arena_free(Arena *a);
+
+static void arena_reset(Arena *a)
+{
+	ArenaBlock *b = a->blocks;
+	if(b && !b->next)
+	{
+		b->used = 0;
+		return;
+	}
+	// Replace the blocks by a single one that's big enough for all of it the next time
+	size_t total = 0;
+	for(; b; b = b->next)
+		total += b->used;
+	arena_free(a);
+	if(total > a->block_size)
+		a->block_size = total;
+}
+
+static void arena_free(Arena *a)
+{
+	for(ArenaBlock *b = a->blocks, *next; b; b = next)
+	{
+		next = b->next;
+		free(b);
+	}
+	a->blocks = NULL;
+}
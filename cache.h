@@ -0,0 +1,453 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// On-disk manifest of files that are known to be up to date, so unchanged files can be skipped on the next run.
+// The file is mapped as is, there is nothing to parse:
+//
+//   CacheHeader
+//   CacheEntry[count]            sorted by path_hash, then by path
+//   CacheString[num_strings]     the strings the files hashed, those of one entry are next to each other
+//   char strings[]               paths, then the text of the hashed strings, not \0 terminated
+//
+// The hashed strings of a file that is skipped still go into the collision check and --symbols.
+// All integers are little-endian. A manifest written with a different fingerprint (options that change the
+// output) is treated as empty, so is one that is truncated or whose entries point outside of it.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The cache manifest is mapped as is, it can only be used on little-endian hosts"
+#endif
+
+#define CACHE_MAGIC "HGC1"
+#define CACHE_VERSION 3
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t fingerprint;
+	int64_t written; // Nanoseconds since the epoch when the manifest was saved
+	uint64_t count;
+	uint64_t num_strings;
+	uint64_t strings_size;
+} CacheHeader;
+
+typedef struct
+{
+	uint64_t path_hash;
+	uint64_t size;
+	int64_t mtime; // Nanoseconds since the epoch
+	uint64_t content_hash;
+	uint32_t path_offset;
+	uint32_t path_length;
+	uint32_t first_string; // In the CacheString array
+	uint32_t num_strings;
+} CacheEntry;
+
+// A string that was hashed in a file, with its hash and the line it's on.
+typedef struct
+{
+	uint64_t hash[2];
+	uint32_t offset; // In strings
+	uint32_t length;
+	int32_t line;
+	uint32_t reserved;
+} CacheString;
+
+typedef struct
+{
+	void *map;
+	size_t map_size;
+	const CacheHeader *header;
+	const CacheEntry *entries;
+	const CacheString *hashed;
+	const char *strings;
+	uint64_t count;
+} Cache;
+
+// A hashed string to be saved, the text isn't owned.
+typedef struct
+{
+	uint64_t hash[2];
+	const char *string;
+	size_t length;
+	int line;
+} CacheHashed;
+
+// An entry to be saved, the path and the strings aren't owned.
+typedef struct
+{
+	const char *path;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t content_hash;
+	const CacheHashed *hashed;
+	size_t num_hashed;
+	const CacheEntry *previous; // Of the manifest that was loaded, its strings are kept instead if not NULL
+} CacheRecord;
+
+static inline uint64_t cache_rotl_(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+typedef struct
+{
+	uint64_t hash;
+	uint64_t size;
+	uint8_t tail[8];
+} CacheHasher;
+
+static void cache_hasher_init(CacheHasher *h, uint64_t seed)
+{
+	h->hash = seed;
+	h->size = 0;
+}
+
+static inline uint64_t cache_hash_word_(uint64_t h, uint64_t w)
+{
+	const uint64_t k1 = 0x9e3779b97f4a7c15ull;
+	const uint64_t k2 = 0xc2b2ae3d27d4eb4full;
+	h ^= cache_rotl_(w * k2, 31) * k1;
+	return cache_rotl_(h, 27) * k1 + k2;
+}
+
+static void cache_hasher_update(CacheHasher *h, const void *ptr, size_t size)
+{
+	const uint8_t *p = ptr;
+	size_t n = h->size % 8;
+	h->size += size;
+	if(n)
+	{
+		size_t k = 8 - n < size ? 8 - n : size;
+		memcpy(h->tail + n, p, k);
+		p += k;
+		size -= k;
+		if(n + k < 8)
+			return;
+		uint64_t w;
+		memcpy(&w, h->tail, 8);
+		h->hash = cache_hash_word_(h->hash, w);
+	}
+	while(size >= 8)
+	{
+		uint64_t w;
+		memcpy(&w, p, 8);
+		h->hash = cache_hash_word_(h->hash, w);
+		p += 8;
+		size -= 8;
+	}
+	memcpy(h->tail, p, size);
+}
+
+static uint64_t cache_hasher_final(CacheHasher *h)
+{
+	uint64_t w = 0;
+	memcpy(&w, h->tail, h->size % 8);
+	uint64_t x = cache_hash_word_(h->hash, w) ^ (h->size * 0x9e3779b97f4a7c15ull);
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+// Not meant to be stable across versions of hg, bump CACHE_VERSION when changing it.
+static uint64_t cache_hash(const void *ptr, size_t size, uint64_t seed)
+{
+	CacheHasher h;
+	cache_hasher_init(&h, seed);
+	cache_hasher_update(&h, ptr, size);
+	return cache_hasher_final(&h);
+}
+
+static int64_t cache_mtime(const struct stat *st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static void cache_free(Cache *cache)
+{
+	if(cache->map)
+		munmap(cache->map, cache->map_size);
+	memset(cache, 0, sizeof(Cache));
+}
+
+static int cache_compare_(uint64_t hash_a, const char *a, size_t length_a, uint64_t hash_b, const char *b, size_t length_b)
+{
+	if(hash_a != hash_b)
+		return hash_a < hash_b ? -1 : 1;
+	int c = memcmp(a, b, length_a < length_b ? length_a : length_b);
+	if(c)
+		return c;
+	return length_a < length_b ? -1 : length_a > length_b;
+}
+
+static inline bool cache_in_range_(uint64_t offset, uint64_t length, uint64_t size)
+{
+	return offset <= size && length <= size - offset;
+}
+
+// Every path and string has to be in the strings and the entries have to be sorted, cache_find relies on both.
+static bool cache_valid_(const Cache *cache)
+{
+	uint64_t strings_size = cache->header->strings_size;
+	for(uint64_t i = 0; i < cache->header->num_strings; ++i)
+	{
+		if(!cache_in_range_(cache->hashed[i].offset, cache->hashed[i].length, strings_size))
+			return false;
+	}
+	for(uint64_t i = 0; i < cache->count; ++i)
+	{
+		const CacheEntry *e = &cache->entries[i];
+		if(!cache_in_range_(e->path_offset, e->path_length, strings_size) ||
+		   !cache_in_range_(e->first_string, e->num_strings, cache->header->num_strings))
+			return false;
+		const CacheEntry *p = i ? &cache->entries[i - 1] : NULL;
+		if(p && cache_compare_(p->path_hash,
+							   cache->strings + p->path_offset,
+							   p->path_length,
+							   e->path_hash,
+							   cache->strings + e->path_offset,
+							   e->path_length) >= 0)
+			return false;
+	}
+	return true;
+}
+
+static bool cache_load(Cache *cache, const char *path, uint64_t fingerprint)
+{
+	memset(cache, 0, sizeof(Cache));
+	int fd = open(path, O_RDONLY);
+	if(fd == -1)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader))
+	{
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return false;
+	const CacheHeader *header = map;
+	size_t available = st.st_size - sizeof(CacheHeader);
+	if(memcmp(header->magic, CACHE_MAGIC, 4) || header->version != CACHE_VERSION ||
+	   header->fingerprint != fingerprint || header->count > available / sizeof(CacheEntry) ||
+	   header->num_strings > (available - header->count * sizeof(CacheEntry)) / sizeof(CacheString) ||
+	   header->strings_size != available - header->count * sizeof(CacheEntry) - header->num_strings * sizeof(CacheString))
+	{
+		munmap(map, st.st_size);
+		return false;
+	}
+	cache->map = map;
+	cache->map_size = st.st_size;
+	cache->header = header;
+	cache->entries = (const CacheEntry *)(header + 1);
+	cache->count = header->count;
+	cache->hashed = (const CacheString *)(cache->entries + cache->count);
+	cache->strings = (const char *)(cache->hashed + header->num_strings);
+	if(!cache_valid_(cache))
+	{
+		cache_free(cache);
+		return false;
+	}
+	return true;
+}
+
+static const CacheEntry *cache_find(const Cache *cache, const char *path)
+{
+	size_t length = strlen(path);
+	uint64_t hash = cache_hash(path, length, 0);
+	size_t lo = 0, hi = cache->count;
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		const CacheEntry *e = &cache->entries[mid];
+		int c = cache_compare_(hash, path, length, e->path_hash, cache->strings + e->path_offset, e->path_length);
+		if(c == 0)
+			return e;
+		if(c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return NULL;
+}
+
+// The modification time alone can't be trusted if the file was changed in the same tick the manifest was written,
+// in that case the content hash has to be compared as well.
+static bool cache_entry_is_current(const Cache *cache, const CacheEntry *e, const struct stat *st)
+{
+	return e->size == (uint64_t)st->st_size && e->mtime == cache_mtime(st) && e->mtime < cache->header->written;
+}
+
+// The i-th string the file of an entry hashed, i < e->num_strings.
+static CacheHashed cache_string(const Cache *cache, const CacheEntry *e, size_t i)
+{
+	const CacheString *string = &cache->hashed[e->first_string + i];
+	CacheHashed h = { { string->hash[0], string->hash[1] }, cache->strings + string->offset, string->length, string->line };
+	return h;
+}
+
+typedef struct
+{
+	CacheEntry entry;
+	const char *path;
+	const CacheHashed *hashed;
+	const CacheEntry *previous; // The strings are those of this entry if not NULL
+} CacheSortEntry_;
+
+static int cache_sort_compare_(const void *a, const void *b)
+{
+	const CacheSortEntry_ *x = a;
+	const CacheSortEntry_ *y = b;
+	return cache_compare_(x->entry.path_hash, x->path, x->entry.path_length, y->entry.path_hash, y->path, y->entry.path_length);
+}
+
+static CacheHashed cache_sort_entry_string_(const Cache *previous, const CacheSortEntry_ *e, size_t i)
+{
+	return e->previous ? cache_string(previous, e->previous, i) : e->hashed[i];
+}
+
+// Writes the records merged with the entries of the previous manifest that weren't updated. The new manifest
+// replaces the old one atomically.
+static bool cache_save(const Cache *previous, const char *path, uint64_t fingerprint, const CacheRecord *records, size_t num_records)
+{
+	size_t capacity = num_records + previous->count;
+	CacheSortEntry_ *entries = malloc((capacity ? capacity : 1) * sizeof(CacheSortEntry_));
+	size_t count = 0;
+	for(size_t i = 0; i < num_records; ++i)
+	{
+		CacheSortEntry_ *e = &entries[count++];
+		e->path = records[i].path;
+		e->entry.path_length = strlen(e->path);
+		e->entry.path_hash = cache_hash(e->path, e->entry.path_length, 0);
+		e->entry.size = records[i].size;
+		e->entry.mtime = records[i].mtime;
+		e->entry.content_hash = records[i].content_hash;
+		e->previous = records[i].previous;
+		e->hashed = records[i].hashed;
+		e->entry.num_strings = e->previous ? e->previous->num_strings : records[i].num_hashed;
+	}
+	qsort(entries, count, sizeof(CacheSortEntry_), cache_sort_compare_);
+
+	// Both lists are sorted, keep the old entries that don't have a new record.
+	size_t num_new = count;
+	size_t j = 0;
+	for(uint64_t i = 0; i < previous->count; ++i)
+	{
+		const CacheEntry *old = &previous->entries[i];
+		const char *old_path = previous->strings + old->path_offset;
+		int c = 1;
+		while(j < num_new && (c = cache_compare_(entries[j].entry.path_hash,
+												 entries[j].path,
+												 entries[j].entry.path_length,
+												 old->path_hash,
+												 old_path,
+												 old->path_length)) < 0)
+			++j;
+		if(j < num_new && c == 0)
+			continue;
+		CacheSortEntry_ *e = &entries[count++];
+		e->entry = *old;
+		e->path = old_path;
+		e->previous = old;
+		e->hashed = NULL;
+	}
+	if(count > num_new)
+		qsort(entries, count, sizeof(CacheSortEntry_), cache_sort_compare_);
+
+	// The paths come first in the strings, the text of the hashed strings after them
+	uint64_t strings_size = 0, num_strings = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		CacheSortEntry_ *e = &entries[i];
+		e->entry.path_offset = strings_size;
+		strings_size += e->entry.path_length;
+		e->entry.first_string = num_strings;
+		num_strings += e->entry.num_strings;
+	}
+	uint64_t paths_size = strings_size;
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(size_t k = 0; k < entries[i].entry.num_strings; ++k)
+			strings_size += cache_sort_entry_string_(previous, &entries[i], k).length;
+	}
+	if(strings_size > UINT32_MAX || num_strings > UINT32_MAX)
+	{
+		free(entries);
+		return false;
+	}
+
+	size_t n = strlen(path);
+	char *temp = malloc(n + 16);
+	snprintf(temp, n + 16, "%s.XXXXXX", path);
+	int fd = mkstemp(temp);
+	if(fd == -1 || fchmod(fd, 0644))
+	{
+		if(fd != -1)
+		{
+			close(fd);
+			unlink(temp);
+		}
+		free(temp);
+		free(entries);
+		return false;
+	}
+	FILE *fp = fdopen(fd, "wb");
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	CacheHeader header = { 0 };
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.version = CACHE_VERSION;
+	header.fingerprint = fingerprint;
+	header.written = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	header.count = count;
+	header.num_strings = num_strings;
+	header.strings_size = strings_size;
+	fwrite(&header, sizeof(header), 1, fp);
+	for(size_t i = 0; i < count; ++i)
+		fwrite(&entries[i].entry, sizeof(CacheEntry), 1, fp);
+	uint64_t offset = paths_size;
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(size_t k = 0; k < entries[i].entry.num_strings; ++k)
+		{
+			CacheHashed h = cache_sort_entry_string_(previous, &entries[i], k);
+			CacheString string = { { h.hash[0], h.hash[1] }, offset, h.length, h.line, 0 };
+			fwrite(&string, sizeof(string), 1, fp);
+			offset += h.length;
+		}
+	}
+	for(size_t i = 0; i < count; ++i)
+		fwrite(entries[i].path, 1, entries[i].entry.path_length, fp);
+	for(size_t i = 0; i < count; ++i)
+	{
+		for(size_t k = 0; k < entries[i].entry.num_strings; ++k)
+		{
+			CacheHashed h = cache_sort_entry_string_(previous, &entries[i], k);
+			fwrite(h.string, 1, h.length, fp);
+		}
+	}
+	bool ok = !ferror(fp);
+	ok = !fclose(fp) && ok;
+	if(ok)
+		ok = !rename(temp, path);
+	if(!ok)
+		unlink(temp);
+	free(temp);
+	free(entries);
+	return ok;
+}
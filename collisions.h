@@ -0,0 +1,293 @@
+#pragma once
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// Every string that was hashed in this run with its hash and where it was first seen, so two different strings
+// with the same hash are noticed even if they are in different files. The index is split into shards by hash, each
+// with its own lock, so workers only wait for each other when they insert into the same shard at the same time.
+// A string that is already in the index costs a probe and a compare, nothing is allocated for it.
+
+#define COLLISION_SHARD_BITS 6
+#define COLLISION_SHARDS (1 << COLLISION_SHARD_BITS)
+
+typedef struct
+{
+	uint64_t hash[2]; // The second word is 0 unless the hash has 128 bits
+	const char *path; // Not owned
+	int line;
+	bool collides; // Another string in the index has the same hash
+	size_t length;
+	char string[];
+} CollisionEntry;
+
+// The mixed hash is kept next to the entry, a probe only looks at an entry if it's likely the same.
+typedef struct
+{
+	uint64_t mixed;
+	CollisionEntry *entry; // NULL if empty
+} CollisionSlot;
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	CollisionSlot *slots; // Open addressing
+	size_t capacity, count;
+	size_t num_colliding;
+	Arena arena;
+} __attribute__((aligned(64))) CollisionShard;
+
+typedef struct
+{
+	CollisionShard shards[COLLISION_SHARDS];
+} CollisionIndex;
+
+static void collision_index_init(CollisionIndex *index)
+{
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+	{
+		CollisionShard *shard = &index->shards[i];
+		pthread_mutex_init(&shard->mutex, NULL);
+		shard->slots = NULL;
+		shard->capacity = shard->count = shard->num_colliding = 0;
+		arena_init(&shard->arena, 64 << 10);
+	}
+}
+
+// The hash may only have 32 bits, they're spread over all bits before they pick a shard and a slot.
+static inline uint64_t collision_mix_(const uint64_t hash[2])
+{
+	uint64_t h = (hash[0] ^ hash[1] * 0xc2b2ae3d27d4eb4f) * 0x9e3779b97f4a7c15;
+	return h ^ h >> 29;
+}
+
+static void collision_grow_(CollisionShard *shard)
+{
+	size_t capacity = shard->capacity ? shard->capacity * 2 : 256;
+	CollisionSlot *slots = calloc(capacity, sizeof(CollisionSlot));
+	for(size_t i = 0; i < shard->capacity; ++i)
+	{
+		CollisionSlot slot = shard->slots[i];
+		if(!slot.entry)
+			continue;
+		size_t k = slot.mixed & (capacity - 1);
+		while(slots[k].entry)
+			k = (k + 1) & (capacity - 1);
+		slots[k] = slot;
+	}
+	free(shard->slots);
+	shard->slots = slots;
+	shard->capacity = capacity;
+}
+
+// Of two locations of the same string the one that sorts first is kept, the report doesn't depend on which worker
+// got there first.
+static bool collision_location_before_(const char *path, int line, const CollisionEntry *e)
+{
+	int c = strcmp(path, e->path);
+	return c < 0 || (c == 0 && line < e->line);
+}
+
+// A string to insert, mixed is set by collision_index_insert.
+typedef struct
+{
+	uint64_t hash[2];
+	uint64_t mixed;
+	const char *string;
+	size_t length;
+	int line;
+	bool added; // The string wasn't in the index yet
+} CollisionKey;
+
+static void collision_insert_(CollisionShard *shard, CollisionKey *key, const char *path)
+{
+	size_t mask = shard->capacity - 1;
+	size_t k = key->mixed & mask;
+	CollisionEntry *same_hash = NULL;
+	for(CollisionEntry *e; (e = shard->slots[k].entry); k = (k + 1) & mask)
+	{
+		if(shard->slots[k].mixed != key->mixed || e->hash[0] != key->hash[0] || e->hash[1] != key->hash[1])
+			continue;
+		if(e->length == key->length && !memcmp(e->string, key->string, key->length))
+		{
+			if(collision_location_before_(path, key->line, e))
+			{
+				e->path = path;
+				e->line = key->line;
+			}
+			key->added = false;
+			return;
+		}
+		same_hash = e;
+	}
+	CollisionEntry *e = arena_alloc(&shard->arena, sizeof(CollisionEntry) + key->length);
+	e->hash[0] = key->hash[0];
+	e->hash[1] = key->hash[1];
+	e->path = path;
+	e->line = key->line;
+	e->collides = false;
+	e->length = key->length;
+	memcpy(e->string, key->string, key->length);
+	shard->slots[k].mixed = key->mixed;
+	shard->slots[k].entry = e;
+	++shard->count;
+	key->added = true;
+	if(same_hash)
+	{
+		shard->num_colliding += !same_hash->collides + 1;
+		same_hash->collides = true;
+		e->collides = true;
+	}
+}
+
+#define COLLISION_PREFETCH 8
+
+// Inserts the strings of one file. They're sorted by shard into scratch first, which has room for count keys, so
+// every shard is locked once for all of its strings and the slots can be prefetched while the lock is held.
+// Afterwards scratch holds the keys with added set.
+static void collision_index_insert(CollisionIndex *index, CollisionKey *keys, size_t count, const char *path, CollisionKey *scratch)
+{
+	size_t offsets[COLLISION_SHARDS + 1] = { 0 };
+	for(size_t i = 0; i < count; ++i)
+	{
+		keys[i].mixed = collision_mix_(keys[i].hash);
+		++offsets[(keys[i].mixed >> (64 - COLLISION_SHARD_BITS)) + 1];
+	}
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+		offsets[i + 1] += offsets[i];
+	size_t next[COLLISION_SHARDS];
+	memcpy(next, offsets, sizeof(next));
+	for(size_t i = 0; i < count; ++i)
+		scratch[next[keys[i].mixed >> (64 - COLLISION_SHARD_BITS)]++] = keys[i];
+
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+	{
+		size_t first = offsets[i], last = offsets[i + 1];
+		if(first == last)
+			continue;
+		CollisionShard *shard = &index->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		while((shard->count + last - first) * 4 > shard->capacity * 3)
+			collision_grow_(shard);
+		size_t mask = shard->capacity - 1;
+		for(size_t k = first; k < last; ++k)
+		{
+			if(k + COLLISION_PREFETCH < last)
+				__builtin_prefetch(&shard->slots[scratch[k + COLLISION_PREFETCH].mixed & mask]);
+			collision_insert_(shard, &scratch[k], path);
+		}
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+// Every string in the index, in no particular order. Only call once no more strings are inserted, the array has
+// to be freed.
+static CollisionEntry **collision_index_entries(CollisionIndex *index, size_t *count)
+{
+	size_t n = 0;
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+		n += index->shards[i].count;
+	CollisionEntry **entries = malloc((n ? n : 1) * sizeof(CollisionEntry *));
+	*count = 0;
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+	{
+		CollisionShard *shard = &index->shards[i];
+		for(size_t k = 0; k < shard->capacity; ++k)
+		{
+			if(shard->slots[k].entry)
+				entries[(*count)++] = shard->slots[k].entry;
+		}
+	}
+	return entries;
+}
+
+static void collision_print_hash(FILE *out, int bits, const uint64_t hash[2])
+{
+	if(bits == 128)
+		fprintf(out, "0x%016" PRIx64 "%016" PRIx64, hash[0], hash[1]);
+	else
+		fprintf(out, "0x%0*" PRIx64, bits / 4, hash[0]);
+}
+
+static int collision_compare_(const void *a, const void *b)
+{
+	const CollisionEntry *x = *(const CollisionEntry *const *)a;
+	const CollisionEntry *y = *(const CollisionEntry *const *)b;
+	if(x->hash[0] != y->hash[0])
+		return x->hash[0] < y->hash[0] ? -1 : 1;
+	if(x->hash[1] != y->hash[1])
+		return x->hash[1] < y->hash[1] ? -1 : 1;
+	int c = strcmp(x->path, y->path);
+	if(c)
+		return c;
+	return x->line - y->line;
+}
+
+// Prints every string that shares its hash with another one, next to the first string with that hash. Only call
+// once no more strings are inserted. Returns the number of strings that collide with the first one.
+static size_t collision_index_report(CollisionIndex *index, int bits, FILE *out)
+{
+	size_t count = 0;
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+		count += index->shards[i].num_colliding;
+	if(count == 0)
+		return 0;
+	CollisionEntry **entries = malloc(count * sizeof(CollisionEntry *));
+	size_t n = 0;
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+	{
+		CollisionShard *shard = &index->shards[i];
+		for(size_t k = 0; k < shard->capacity; ++k)
+		{
+			CollisionEntry *e = shard->slots[k].entry;
+			if(e && e->collides)
+				entries[n++] = e;
+		}
+	}
+	qsort(entries, n, sizeof(CollisionEntry *), collision_compare_);
+	size_t reported = 0;
+	for(size_t i = 0, first = 0; i < n; ++i)
+	{
+		const CollisionEntry *a = entries[first], *b = entries[i];
+		if(a->hash[0] != b->hash[0] || a->hash[1] != b->hash[1])
+		{
+			first = i;
+			continue;
+		}
+		if(i == first)
+			continue;
+		fprintf(out, "Hash collision ");
+		collision_print_hash(out, bits, a->hash);
+		fprintf(out,
+				": '%.*s' at %s:%d and '%.*s' at %s:%d\n",
+				(int)a->length,
+				a->string,
+				a->path,
+				a->line,
+				(int)b->length,
+				b->string,
+				b->path,
+				b->line);
+		++reported;
+	}
+	free(entries);
+	return reported;
+}
+
+static void collision_index_free(CollisionIndex *index)
+{
+	for(int i = 0; i < COLLISION_SHARDS; ++i)
+	{
+		CollisionShard *shard = &index->shards[i];
+		free(shard->slots);
+		arena_free(&shard->arena);
+		pthread_mutex_destroy(&shard->mutex);
+	}
+}
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Hash functions the literals can be computed with, selected by name with -a. A hash is one or two 64-bit words,
+// a 32-bit hash is in the low half of the first word. A 128-bit hash is written as two literals, the first word
+// first.
+//
+//   fnv1a_32, fnv1a_64  https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+//                       Bytes are sign-extended before they're mixed in, as hg always did.
+//   xxh64, xxh3         https://github.com/Cyan4973/xxHash, seed 0 and the default secret
+//   murmur3_128         MurmurHash3_x64_128, seed 0, the first word is h1
+//
+// Every algorithm has a batch function that hashes many strings in one call. FNV-1a is one long chain of
+// dependent multiplies, the batch runs HASH_LANES strings side by side so their multiplies overlap. Gathering the
+// bytes of different strings into SIMD registers costs more than the multiplies it would save, so the lanes are
+// plain registers.
+
+#define HASH_LANES 4
+
+typedef void (*HashFunction)(const char *data, size_t length, uint64_t *out);
+// out has hash_words entries for every string.
+typedef void (*HashBatchFunction)(const char *const *data, const size_t *lengths, size_t count, uint64_t *out);
+
+typedef struct
+{
+	const char *name;
+	int bits; // 32, 64 or 128
+	HashFunction hash;
+	HashBatchFunction batch;
+} HashAlgorithm;
+
+static inline int hash_words(const HashAlgorithm *a)
+{
+	return a->bits == 128 ? 2 : 1;
+}
+
+static inline uint64_t hash_read64_(const char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t hash_read32_(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t hash_rotl64_(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_mul128_fold64_(uint64_t a, uint64_t b)
+{
+	unsigned __int128 product = (unsigned __int128)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+// FNV-1a
+
+#define HASH_FNV32_OFFSET 0x811c9dc5u
+#define HASH_FNV32_PRIME 0x01000193u
+#define HASH_FNV64_OFFSET 0xcbf29ce484222325ull
+#define HASH_FNV64_PRIME 0x00000100000001B3ull
+
+static void hash_fnv1a_32(const char *data, size_t length, uint64_t *out)
+{
+	uint32_t hash = HASH_FNV32_OFFSET;
+	for(size_t i = 0; i < length; ++i)
+		hash = (hash ^ data[i]) * HASH_FNV32_PRIME;
+	out[0] = hash;
+}
+
+static void hash_fnv1a_64(const char *data, size_t length, uint64_t *out)
+{
+	uint64_t hash = HASH_FNV64_OFFSET;
+	for(size_t i = 0; i < length; ++i)
+		hash = (hash ^ data[i]) * HASH_FNV64_PRIME;
+	out[0] = hash;
+}
+
+// The lanes step together up to the shortest string, the rest of each string is finished on its own.
+#define HASH_FNV_BATCH_(name, type, offset, prime)                                                                     \
+	static void name(const char *const *data, const size_t *lengths, size_t count, uint64_t *out)                      \
+	{                                                                                                                  \
+		size_t i = 0;                                                                                                  \
+		for(; i + HASH_LANES <= count; i += HASH_LANES)                                                                \
+		{                                                                                                              \
+			type h[HASH_LANES];                                                                                        \
+			size_t common = lengths[i];                                                                                \
+			for(int k = 0; k < HASH_LANES; ++k)                                                                        \
+			{                                                                                                          \
+				h[k] = offset;                                                                                         \
+				if(lengths[i + k] < common)                                                                            \
+					common = lengths[i + k];                                                                           \
+			}                                                                                                          \
+			for(size_t j = 0; j < common; ++j)                                                                         \
+			{                                                                                                          \
+				for(int k = 0; k < HASH_LANES; ++k)                                                                    \
+					h[k] = (h[k] ^ data[i + k][j]) * prime;                                                            \
+			}                                                                                                          \
+			for(int k = 0; k < HASH_LANES; ++k)                                                                        \
+			{                                                                                                          \
+				for(size_t j = common; j < lengths[i + k]; ++j)                                                        \
+					h[k] = (h[k] ^ data[i + k][j]) * prime;                                                            \
+				out[i + k] = h[k];                                                                                     \
+			}                                                                                                          \
+		}                                                                                                              \
+		for(; i < count; ++i)                                                                                          \
+		{                                                                                                              \
+			type h = offset;                                                                                           \
+			for(size_t j = 0; j < lengths[i]; ++j)                                                                     \
+				h = (h ^ data[i][j]) * prime;                                                                          \
+			out[i] = h;                                                                                                \
+		}                                                                                                              \
+	}
+
+HASH_FNV_BATCH_(hash_fnv1a_32_batch, uint32_t, HASH_FNV32_OFFSET, HASH_FNV32_PRIME)
+HASH_FNV_BATCH_(hash_fnv1a_64_batch, uint64_t, HASH_FNV64_OFFSET, HASH_FNV64_PRIME)
+
+// XXH64
+
+#define HASH_XXH_PRIME32_1 0x9E3779B1u
+#define HASH_XXH_PRIME32_2 0x85EBCA77u
+#define HASH_XXH_PRIME32_3 0xC2B2AE3Du
+#define HASH_XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define HASH_XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define HASH_XXH_PRIME64_3 0x165667B19E3779F9ull
+#define HASH_XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define HASH_XXH_PRIME64_5 0x27D4EB2F165667C5ull
+
+static inline uint64_t hash_xxh64_round_(uint64_t acc, uint64_t input)
+{
+	acc += input * HASH_XXH_PRIME64_2;
+	acc = hash_rotl64_(acc, 31);
+	return acc * HASH_XXH_PRIME64_1;
+}
+
+static inline uint64_t hash_xxh64_merge_round_(uint64_t acc, uint64_t value)
+{
+	acc ^= hash_xxh64_round_(0, value);
+	return acc * HASH_XXH_PRIME64_1 + HASH_XXH_PRIME64_4;
+}
+
+static inline uint64_t hash_xxh64_avalanche_(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= HASH_XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= HASH_XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static void hash_xxh64(const char *data, size_t length, uint64_t *out)
+{
+	const char *p = data, *end = data + length;
+	uint64_t h;
+	if(length >= 32)
+	{
+		uint64_t v1 = HASH_XXH_PRIME64_1 + HASH_XXH_PRIME64_2;
+		uint64_t v2 = HASH_XXH_PRIME64_2;
+		uint64_t v3 = 0;
+		uint64_t v4 = -HASH_XXH_PRIME64_1;
+		for(; end - p >= 32; p += 32)
+		{
+			v1 = hash_xxh64_round_(v1, hash_read64_(p));
+			v2 = hash_xxh64_round_(v2, hash_read64_(p + 8));
+			v3 = hash_xxh64_round_(v3, hash_read64_(p + 16));
+			v4 = hash_xxh64_round_(v4, hash_read64_(p + 24));
+		}
+		h = hash_rotl64_(v1, 1) + hash_rotl64_(v2, 7) + hash_rotl64_(v3, 12) + hash_rotl64_(v4, 18);
+		h = hash_xxh64_merge_round_(h, v1);
+		h = hash_xxh64_merge_round_(h, v2);
+		h = hash_xxh64_merge_round_(h, v3);
+		h = hash_xxh64_merge_round_(h, v4);
+	}
+	else
+	{
+		h = HASH_XXH_PRIME64_5;
+	}
+	h += length;
+	for(; end - p >= 8; p += 8)
+	{
+		h ^= hash_xxh64_round_(0, hash_read64_(p));
+		h = hash_rotl64_(h, 27) * HASH_XXH_PRIME64_1 + HASH_XXH_PRIME64_4;
+	}
+	if(end - p >= 4)
+	{
+		h ^= (uint64_t)hash_read32_(p) * HASH_XXH_PRIME64_1;
+		h = hash_rotl64_(h, 23) * HASH_XXH_PRIME64_2 + HASH_XXH_PRIME64_3;
+		p += 4;
+	}
+	for(; p < end; ++p)
+	{
+		h ^= (uint8_t)*p * HASH_XXH_PRIME64_5;
+		h = hash_rotl64_(h, 11) * HASH_XXH_PRIME64_1;
+	}
+	out[0] = hash_xxh64_avalanche_(h);
+}
+
+// XXH3, 64-bit output
+
+static const uint8_t hash_xxh3_secret_[192] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9,
+	0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+	0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21, 0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+	0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8, 0xa8, 0xfa, 0x76, 0x3f,
+	0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+	0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff,
+	0xfa, 0x13, 0x63, 0xeb, 0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+	0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+#define HASH_XXH3_MX1 0x165667919E3779F9ull
+#define HASH_XXH3_MX2 0x9FB21C651E98DF25ull
+
+static inline uint64_t hash_xxh3_secret64_(size_t offset)
+{
+	return hash_read64_((const char *)hash_xxh3_secret_ + offset);
+}
+
+static inline uint64_t hash_xxh3_avalanche_(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= HASH_XXH3_MX1;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t hash_xxh3_mix16_(const char *p, size_t secret)
+{
+	return hash_mul128_fold64_(hash_read64_(p) ^ hash_xxh3_secret64_(secret),
+							   hash_read64_(p + 8) ^ hash_xxh3_secret64_(secret + 8));
+}
+
+// Inputs longer than 240 bytes, in stripes of 64 bytes.
+static inline void hash_xxh3_accumulate_(uint64_t *acc, const char *p, size_t secret)
+{
+	for(int lane = 0; lane < 8; ++lane)
+	{
+		uint64_t value = hash_read64_(p + lane * 8);
+		uint64_t key = value ^ hash_xxh3_secret64_(secret + lane * 8);
+		acc[lane ^ 1] += value;
+		acc[lane] += (key & 0xffffffff) * (key >> 32);
+	}
+}
+
+static uint64_t hash_xxh3_long_(const char *data, size_t length)
+{
+	uint64_t acc[8] = { HASH_XXH_PRIME32_3, HASH_XXH_PRIME64_1, HASH_XXH_PRIME64_2, HASH_XXH_PRIME64_3,
+						HASH_XXH_PRIME64_4, HASH_XXH_PRIME32_2, HASH_XXH_PRIME64_5, HASH_XXH_PRIME32_1 };
+	const size_t stripes_per_block = (sizeof(hash_xxh3_secret_) - 64) / 8;
+	const size_t block_length = 64 * stripes_per_block;
+	size_t num_blocks = (length - 1) / block_length;
+	for(size_t n = 0; n < num_blocks; ++n)
+	{
+		for(size_t s = 0; s < stripes_per_block; ++s)
+			hash_xxh3_accumulate_(acc, data + n * block_length + s * 64, s * 8);
+		for(int lane = 0; lane < 8; ++lane)
+		{
+			uint64_t a = acc[lane];
+			a ^= a >> 47;
+			a ^= hash_xxh3_secret64_(sizeof(hash_xxh3_secret_) - 64 + lane * 8);
+			acc[lane] = a * HASH_XXH_PRIME32_1;
+		}
+	}
+	size_t num_stripes = ((length - 1) - block_length * num_blocks) / 64;
+	for(size_t s = 0; s < num_stripes; ++s)
+		hash_xxh3_accumulate_(acc, data + num_blocks * block_length + s * 64, s * 8);
+	hash_xxh3_accumulate_(acc, data + length - 64, sizeof(hash_xxh3_secret_) - 64 - 7);
+
+	uint64_t h = length * HASH_XXH_PRIME64_1;
+	for(int i = 0; i < 4; ++i)
+		h += hash_mul128_fold64_(acc[2 * i] ^ hash_xxh3_secret64_(11 + 16 * i),
+								 acc[2 * i + 1] ^ hash_xxh3_secret64_(11 + 16 * i + 8));
+	return hash_xxh3_avalanche_(h);
+}
+
+static void hash_xxh3(const char *data, size_t length, uint64_t *out)
+{
+	const char *p = data;
+	uint64_t h;
+	if(length == 0)
+	{
+		h = hash_xxh64_avalanche_(hash_xxh3_secret64_(56) ^ hash_xxh3_secret64_(64));
+	}
+	else if(length <= 3)
+	{
+		uint32_t combined = ((uint32_t)(uint8_t)p[0] << 16) | ((uint32_t)(uint8_t)p[length >> 1] << 24) |
+							(uint32_t)(uint8_t)p[length - 1] | ((uint32_t)length << 8);
+		uint64_t bitflip = (uint64_t)(hash_read32_((const char *)hash_xxh3_secret_) ^
+									  hash_read32_((const char *)hash_xxh3_secret_ + 4));
+		h = hash_xxh64_avalanche_(combined ^ bitflip);
+	}
+	else if(length <= 8)
+	{
+		uint64_t input = hash_read32_(p + length - 4) + ((uint64_t)hash_read32_(p) << 32);
+		h = input ^ (hash_xxh3_secret64_(8) ^ hash_xxh3_secret64_(16));
+		h ^= hash_rotl64_(h, 49) ^ hash_rotl64_(h, 24);
+		h *= HASH_XXH3_MX2;
+		h ^= (h >> 35) + length;
+		h *= HASH_XXH3_MX2;
+		h ^= h >> 28;
+	}
+	else if(length <= 16)
+	{
+		uint64_t lo = hash_read64_(p) ^ (hash_xxh3_secret64_(24) ^ hash_xxh3_secret64_(32));
+		uint64_t hi = hash_read64_(p + length - 8) ^ (hash_xxh3_secret64_(40) ^ hash_xxh3_secret64_(48));
+		h = hash_xxh3_avalanche_(length + __builtin_bswap64(lo) + hi + hash_mul128_fold64_(lo, hi));
+	}
+	else if(length <= 128)
+	{
+		h = length * HASH_XXH_PRIME64_1;
+		for(size_t i = 0; i <= (length - 1) / 32; ++i)
+		{
+			h += hash_xxh3_mix16_(p + 16 * i, 32 * i);
+			h += hash_xxh3_mix16_(p + length - 16 * (i + 1), 32 * i + 16);
+		}
+		h = hash_xxh3_avalanche_(h);
+	}
+	else if(length <= 240)
+	{
+		h = length * HASH_XXH_PRIME64_1;
+		for(size_t i = 0; i < 8; ++i)
+			h += hash_xxh3_mix16_(p + 16 * i, 16 * i);
+		h = hash_xxh3_avalanche_(h);
+		uint64_t tail = hash_xxh3_mix16_(p + length - 16, 136 - 17);
+		for(size_t i = 8; i < length / 16; ++i)
+			tail += hash_xxh3_mix16_(p + 16 * i, 16 * (i - 8) + 3);
+		h = hash_xxh3_avalanche_(h + tail);
+	}
+	else
+	{
+		h = hash_xxh3_long_(data, length);
+	}
+	out[0] = h;
+}
+
+// MurmurHash3_x64_128
+
+static inline uint64_t hash_murmur3_fmix64_(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+static void hash_murmur3_128(const char *data, size_t length, uint64_t *out)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull;
+	const uint64_t c2 = 0x4cf5ad432745937full;
+	uint64_t h1 = 0, h2 = 0;
+	size_t num_blocks = length / 16;
+	for(size_t i = 0; i < num_blocks; ++i)
+	{
+		uint64_t k1 = hash_read64_(data + i * 16);
+		uint64_t k2 = hash_read64_(data + i * 16 + 8);
+		k1 = hash_rotl64_(k1 * c1, 31) * c2;
+		h1 ^= k1;
+		h1 = (hash_rotl64_(h1, 27) + h2) * 5 + 0x52dce729;
+		k2 = hash_rotl64_(k2 * c2, 33) * c1;
+		h2 ^= k2;
+		h2 = (hash_rotl64_(h2, 31) + h1) * 5 + 0x38495ab5;
+	}
+	const uint8_t *tail = (const uint8_t *)data + num_blocks * 16;
+	uint64_t k1 = 0, k2 = 0;
+	size_t rest = length & 15;
+	for(size_t i = rest; i > 8; --i)
+		k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+	if(rest > 8)
+		h2 ^= hash_rotl64_(k2 * c2, 33) * c1;
+	for(size_t i = rest < 8 ? rest : 8; i > 0; --i)
+		k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+	if(rest > 0)
+		h1 ^= hash_rotl64_(k1 * c1, 31) * c2;
+	h1 ^= length;
+	h2 ^= length;
+	h1 += h2;
+	h2 += h1;
+	h1 = hash_murmur3_fmix64_(h1);
+	h2 = hash_murmur3_fmix64_(h2);
+	h1 += h2;
+	h2 += h1;
+	out[0] = h1;
+	out[1] = h2;
+}
+
+// Hashes one string after the other, for algorithms that already keep several multiplies in flight per string.
+#define HASH_BATCH_(name, function, words)                                                                             \
+	static void name(const char *const *data, const size_t *lengths, size_t count, uint64_t *out)                      \
+	{                                                                                                                  \
+		for(size_t i = 0; i < count; ++i)                                                                              \
+			function(data[i], lengths[i], out + i * (words));                                                          \
+	}
+
+HASH_BATCH_(hash_xxh64_batch, hash_xxh64, 1)
+HASH_BATCH_(hash_xxh3_batch, hash_xxh3, 1)
+HASH_BATCH_(hash_murmur3_128_batch, hash_murmur3_128, 2)
+
+static const HashAlgorithm hash_algorithms[] = {
+	{ "fnv1a_32", 32, hash_fnv1a_32, hash_fnv1a_32_batch },
+	{ "fnv1a_64", 64, hash_fnv1a_64, hash_fnv1a_64_batch },
+	{ "xxh64", 64, hash_xxh64, hash_xxh64_batch },
+	{ "xxh3", 64, hash_xxh3, hash_xxh3_batch },
+	{ "murmur3_128", 128, hash_murmur3_128, hash_murmur3_128_batch },
+};
+
+static const HashAlgorithm *hash_find(const char *name)
+{
+	for(size_t i = 0; i < sizeof(hash_algorithms) / sizeof(hash_algorithms[0]); ++i)
+	{
+		if(!strcmp(hash_algorithms[i].name, name))
+			return &hash_algorithms[i];
+	}
+	return NULL;
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Symbol file written by hg --symbols, maps the hashes hg wrote back to the strings they are the hash of. The file
+// is mapped as is, a lookup is an index into the bucket table and a compare of the few entries in the bucket:
+//
+//   HgSymHeader
+//   uint32_t buckets[(1 << bucket_bits) + 2]   entries [buckets[b], buckets[b + 1]) are in bucket b, the last
+//                                              one is padding
+//   HgSymEntry entries[count]                  sorted by hash, then by string
+//   char strings[strings_size]                 every string is \0 terminated
+//
+// The bucket of a hash is the top bucket_bits bits of its first word, of the low 32 bits for a 32-bit hash. There
+// are at least as many buckets as entries. A 128-bit hash is written as two literals, hash[0] is the first one.
+// Two strings with the same hash are next to each other, hg reports them as collisions when it writes the file.
+// All integers are little-endian. hgsym_open checks that the bucket table and the entries stay inside the file, a
+// truncated or corrupt file isn't opened.
+//
+// Reading:
+//
+//   HgSym sym;
+//   if(hgsym_open(&sym, "symbols.hgs"))
+//   {
+//       const HgSymEntry *e = hgsym_find(&sym, 0x49a1e611, 0);
+//       if(e)
+//           puts(hgsym_string(&sym, e));
+//       hgsym_close(&sym);
+//   }
+//
+// The writer is only compiled with HGSYM_WRITER defined.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The symbol file is mapped as is, it can only be used on little-endian hosts"
+#endif
+
+#define HGSYM_MAGIC "HGS1"
+#define HGSYM_VERSION 1
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	char algorithm[16]; // The name hg -a takes, \0 terminated
+	uint32_t bits;		// 32, 64 or 128
+	uint32_t bucket_bits;
+	uint64_t count;
+	uint64_t strings_size;
+} HgSymHeader;
+
+typedef struct
+{
+	uint64_t hash[2]; // The second word is 0 unless the hash has 128 bits
+	uint32_t offset;  // In strings
+	uint32_t length;
+} HgSymEntry;
+
+typedef struct
+{
+	void *map;
+	size_t map_size;
+	const HgSymHeader *header;
+	const uint32_t *buckets;
+	const HgSymEntry *entries;
+	const char *strings;
+} HgSym;
+
+static inline size_t hgsym_num_buckets_(uint32_t bucket_bits)
+{
+	return bucket_bits < 32 ? ((size_t)1 << bucket_bits) + 2 : 0;
+}
+
+static inline uint64_t hgsym_bucket_(const HgSymHeader *header, uint64_t hash)
+{
+	if(header->bucket_bits == 0)
+		return 0;
+	if(header->bits == 32)
+		hash <<= 32;
+	return hash >> (64 - header->bucket_bits);
+}
+
+static inline void hgsym_close(HgSym *sym)
+{
+	if(sym->map)
+		munmap(sym->map, sym->map_size);
+	memset(sym, 0, sizeof(HgSym));
+}
+
+// Every bucket has to end where the next one starts and every string has to be in the strings, \0 terminated.
+static inline bool hgsym_valid_(const HgSym *sym)
+{
+	const HgSymHeader *header = sym->header;
+	size_t num_buckets = hgsym_num_buckets_(header->bucket_bits);
+	if(sym->buckets[0] != 0 || sym->buckets[num_buckets - 2] != header->count)
+		return false;
+	for(size_t b = 0; b + 2 < num_buckets; ++b)
+	{
+		if(sym->buckets[b] > sym->buckets[b + 1])
+			return false;
+	}
+	for(uint64_t i = 0; i < header->count; ++i)
+	{
+		const HgSymEntry *e = &sym->entries[i];
+		if(e->offset >= header->strings_size || e->length >= header->strings_size - e->offset ||
+		   sym->strings[e->offset + e->length] != 0)
+			return false;
+	}
+	return true;
+}
+
+static inline bool hgsym_open(HgSym *sym, const char *path)
+{
+	memset(sym, 0, sizeof(HgSym));
+	int fd = open(path, O_RDONLY);
+	if(fd == -1)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(HgSymHeader))
+	{
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return false;
+	const HgSymHeader *header = map;
+	size_t num_buckets = hgsym_num_buckets_(header->bucket_bits);
+	size_t available = st.st_size - sizeof(HgSymHeader);
+	size_t buckets_size = num_buckets * sizeof(uint32_t);
+	if(memcmp(header->magic, HGSYM_MAGIC, 4) || header->version != HGSYM_VERSION ||
+	   (header->bits != 32 && header->bits != 64 && header->bits != 128) || num_buckets == 0 ||
+	   buckets_size > available || header->count > (available - buckets_size) / sizeof(HgSymEntry) ||
+	   header->strings_size != available - buckets_size - header->count * sizeof(HgSymEntry))
+	{
+		munmap(map, st.st_size);
+		return false;
+	}
+	sym->map = map;
+	sym->map_size = st.st_size;
+	sym->header = header;
+	sym->buckets = (const uint32_t *)(header + 1);
+	sym->entries = (const HgSymEntry *)(sym->buckets + num_buckets);
+	sym->strings = (const char *)(sym->entries + header->count);
+	if(!hgsym_valid_(sym))
+	{
+		hgsym_close(sym);
+		return false;
+	}
+	return true;
+}
+
+// The first entry with the hash, or NULL. hash_high is the second literal of a 128-bit hash and 0 otherwise.
+static inline const HgSymEntry *hgsym_find(const HgSym *sym, uint64_t hash, uint64_t hash_high)
+{
+	uint64_t b = hgsym_bucket_(sym->header, hash);
+	for(uint32_t i = sym->buckets[b], end = sym->buckets[b + 1]; i < end; ++i)
+	{
+		const HgSymEntry *e = &sym->entries[i];
+		if(e->hash[0] == hash && e->hash[1] == hash_high)
+			return e;
+	}
+	return NULL;
+}
+
+static inline const char *hgsym_string(const HgSym *sym, const HgSymEntry *e)
+{
+	return sym->strings + e->offset;
+}
+
+#ifdef HGSYM_WRITER
+
+// A symbol to be written, the string isn't owned.
+typedef struct
+{
+	uint64_t hash[2];
+	const char *string;
+	size_t length;
+} HgSymSymbol;
+
+static int hgsym_compare_(const void *a, const void *b)
+{
+	const HgSymSymbol *x = a;
+	const HgSymSymbol *y = b;
+	if(x->hash[0] != y->hash[0])
+		return x->hash[0] < y->hash[0] ? -1 : 1;
+	if(x->hash[1] != y->hash[1])
+		return x->hash[1] < y->hash[1] ? -1 : 1;
+	int c = memcmp(x->string, y->string, x->length < y->length ? x->length : y->length);
+	if(c)
+		return c;
+	return x->length < y->length ? -1 : x->length > y->length;
+}
+
+// Sorts the symbols and writes them to a new file that replaces path atomically.
+static bool hgsym_write(const char *path, const char *algorithm, int bits, HgSymSymbol *symbols, size_t count)
+{
+	qsort(symbols, count, sizeof(HgSymSymbol), hgsym_compare_);
+	HgSymHeader header = { 0 };
+	memcpy(header.magic, HGSYM_MAGIC, 4);
+	header.version = HGSYM_VERSION;
+	snprintf(header.algorithm, sizeof(header.algorithm), "%s", algorithm);
+	header.bits = bits;
+	while(header.bucket_bits < 31 && ((uint64_t)1 << header.bucket_bits) < count)
+		++header.bucket_bits;
+	header.count = count;
+
+	size_t num_buckets = hgsym_num_buckets_(header.bucket_bits);
+	uint32_t *buckets = calloc(num_buckets, sizeof(uint32_t));
+	for(size_t i = 0; i < count; ++i)
+	{
+		header.strings_size += symbols[i].length + 1;
+		++buckets[hgsym_bucket_(&header, symbols[i].hash[0]) + 1];
+	}
+	for(size_t b = 1; b < num_buckets - 1; ++b)
+		buckets[b] += buckets[b - 1];
+	if(header.strings_size > UINT32_MAX || count > UINT32_MAX)
+	{
+		free(buckets);
+		return false;
+	}
+
+	size_t n = strlen(path);
+	char *temp = malloc(n + 16);
+	snprintf(temp, n + 16, "%s.XXXXXX", path);
+	int fd = mkstemp(temp);
+	if(fd == -1 || fchmod(fd, 0644))
+	{
+		if(fd != -1)
+		{
+			close(fd);
+			unlink(temp);
+		}
+		free(temp);
+		free(buckets);
+		return false;
+	}
+	FILE *fp = fdopen(fd, "wb");
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(buckets, sizeof(uint32_t), num_buckets, fp);
+	uint32_t offset = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		HgSymEntry e = { { symbols[i].hash[0], symbols[i].hash[1] }, offset, (uint32_t)symbols[i].length };
+		fwrite(&e, sizeof(e), 1, fp);
+		offset += symbols[i].length + 1;
+	}
+	for(size_t i = 0; i < count; ++i)
+	{
+		fwrite(symbols[i].string, 1, symbols[i].length, fp);
+		fputc(0, fp);
+	}
+	bool ok = !ferror(fp);
+	ok = !fclose(fp) && ok;
+	if(ok)
+		ok = !rename(temp, path);
+	if(!ok)
+		unlink(temp);
+	free(temp);
+	free(buckets);
+	return ok;
+}
+
+#endif
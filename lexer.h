@@ -1,6 +1,8 @@
 #pragma once
 
 #include "stream.h"
+#include "scan.h"
+#include "arena.h"
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -56,6 +58,11 @@ typedef struct Token_s
 	u16 token_type;
 	u64 hash;
 	u16 length;
+	// Plain decimal and 0x hexadecimal numbers are decoded while they're lexed. base is 10 or 16 and digits is the
+	// number of digits without the 0x, base is 0 for any other number which lexer_token_read_int has to parse.
+	u64 value;
+	u8 base;
+	u8 digits;
 } Token;
 
 typedef enum
@@ -70,15 +77,34 @@ typedef enum
 	LEXER_FLAG_TOKEN_TYPE_MULTILINE_COMMENT_ENABLED = 64,
 	LEXER_FLAG_PRINT_SOURCE_ON_ERROR = 128,
 	LEXER_FLAG_STRING_RAW =
-		256 // Tries to include quotes, if EOF is reached then the string won't have a closing quote though
+		256, // Tries to include quotes, if EOF is reached then the string won't have a closing quote though
+	LEXER_FLAG_STRING_SINGLE_LINE = 512, // Strings are terminated by a newline, the newline itself is not part of the string
+	LEXER_FLAG_LOOKAHEAD = 1024 // Tokens that are peeked at are kept, lexer_accept never has to go back and lex them again
 } k_ELexerFlags;
 
-typedef struct
+#define LEXER_LOOKAHEAD 4
+
+typedef struct Lexer_s
 {
 	Stream *stream;
 	jmp_buf jmp_error;
 	int flags;
 	FILE *out;
+
+	// Set if the stream is backed by memory, the lexer then walks the buffer itself and shares the offset with the
+	// stream. The stream must not be written to while it's being lexed.
+	const u8 *buffer;
+	size_t length;
+	size_t *offset;
+
+	// Tokens that have been lexed ahead with LEXER_FLAG_LOOKAHEAD, ring_from is where the stream was before each one.
+	Token ring[LEXER_LOOKAHEAD];
+	s64 ring_from[LEXER_LOOKAHEAD];
+	int ring_head, ring_count;
+
+	// Lexer specialized for step_flags, see LEXER_INSTANTIATE. Only used while flags are the same.
+	int (*step)(struct Lexer_s *lexer, Token *t);
+	int step_flags;
 } Lexer;
 
 LEXER_STATIC int lexer_step(Lexer *lexer, Token *t);
@@ -88,29 +114,102 @@ LEXER_STATIC void lexer_init(Lexer *l, /*deprecated*/ void *arena, Stream *strea
 	l->stream = stream;
 	l->flags = LEXER_FLAG_NONE;
 	l->out = stdout;
+	l->buffer = NULL;
+	l->length = 0;
+	l->offset = NULL;
+	l->ring_head = 0;
+	l->ring_count = 0;
+	l->step = NULL;
+	l->step_flags = 0;
+	if(stream->memory && stream->memory(stream, &l->buffer, &l->length, &l->offset))
+		l->buffer = NULL;
+}
+
+static inline s64 lexer_tell(Lexer *l)
+{
+	if(l->buffer)
+		return *l->offset;
+	return l->stream->tell(l->stream);
+}
+
+// Any tokens that were lexed ahead are dropped.
+static inline void lexer_seek(Lexer *l, s64 position)
+{
+	l->ring_count = 0;
+	if(l->buffer)
+	{
+		*l->offset = (size_t)position < l->length ? (size_t)position : l->length;
+		return;
+	}
+	l->stream->seek(l->stream, position, STREAM_SEEK_BEG);
+}
+
+// Where the stream would be if nothing had been lexed ahead, right after the last token that was consumed.
+static inline s64 lexer_offset(Lexer *l)
+{
+	if(l->ring_count)
+		return l->ring_from[l->ring_head];
+	return lexer_tell(l);
+}
+
+// The text of the token in the source, NULL if the stream isn't backed by memory.
+static inline const u8 *lexer_token_text(Lexer *l, const Token *t)
+{
+	return l->buffer ? l->buffer + t->position : NULL;
 }
 
 LEXER_STATIC void lexer_token_read_string(Lexer *lexer, Token *t, char *temp, s32 max_temp_size)
 {
-	Stream *ls = lexer->stream;
-	s32 pos = ls->tell(ls);
-	ls->seek(ls, t->position, SEEK_SET);
 	s32 n = max_temp_size - 1;
 	if(t->length < n)
 		n = t->length;
+	if(lexer->buffer)
+	{
+		size_t available = (size_t)t->position < lexer->length ? lexer->length - t->position : 0;
+		if((size_t)n > available)
+			n = available;
+		memcpy(temp, lexer->buffer + t->position, n);
+		temp[n] = 0;
+		return;
+	}
+	Stream *ls = lexer->stream;
+	s32 pos = ls->tell(ls);
+	ls->seek(ls, t->position, SEEK_SET);
 	ls->read(ls, temp, 1, n);
 	temp[n] = 0;
 	ls->seek(ls, pos, SEEK_SET);
 }
 
-LEXER_STATIC u8 lexer_read_and_advance(Lexer *l)
+static inline u8 lexer_read_and_advance(Lexer *l)
 {
+	if(l->buffer)
+	{
+		size_t offset = *l->offset;
+		if(offset >= l->length)
+			return 0;
+		*l->offset = offset + 1;
+		return l->buffer[offset];
+	}
 	u8 buf = 0;
 	if(l->stream->read(l->stream, &buf, 1, 1) != 1)
 		return 0;
 	return buf;
 }
 
+static inline void lexer_unget(Lexer *l);
+
+// Returns the next character without consuming it, 0 at the end of the stream.
+static inline u8 lexer_peek(Lexer *l)
+{
+	if(l->buffer)
+		return *l->offset < l->length ? l->buffer[*l->offset] : 0;
+	u8 buf = 0;
+	if(l->stream->read(l->stream, &buf, 1, 1) != 1)
+		return 0;
+	lexer_unget(l);
+	return buf;
+}
+
 LEXER_STATIC void lexer_token_print_range_characters(Lexer *lexer, Token *t, int range_min, int range_max)
 {
 	Stream *ls = lexer->stream;
@@ -140,7 +239,7 @@ LEXER_STATIC void lexer_error(Lexer *l, const char *fmt, ...)
 		va_end(va);
 	}
 	Token ft = { 0 };
-	ft.position = l->stream->tell(l->stream);
+	ft.position = lexer_tell(l);
 	if(l->flags & LEXER_FLAG_PRINT_SOURCE_ON_ERROR)
 	{
 		fprintf(l->out, "===============================================================\n");
@@ -153,32 +252,125 @@ LEXER_STATIC void lexer_error(Lexer *l, const char *fmt, ...)
 
 LEXER_STATIC void lexer_unget_token(Lexer *l, Token *t)
 {
-	s64 current = l->stream->tell(l->stream);
+	s64 current = lexer_tell(l);
 	if(current == 0)
 		return;
-	l->stream->seek(l->stream, t->position, SEEK_SET);
+	lexer_seek(l, t->position);
 }
 
-LEXER_STATIC void lexer_unget(Lexer *l)
+static inline void lexer_unget(Lexer *l)
 {
+	if(l->buffer)
+	{
+		if(*l->offset > 0)
+			--*l->offset;
+		return;
+	}
 	s64 current = l->stream->tell(l->stream);
 	if(current == 0)
 		return;
 	l->stream->seek(l->stream, current - 1, SEEK_SET);
 }
 
-LEXER_STATIC Token *lexer_read_string(Lexer *lexer, Token *t)
+// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+#define LEXER_FNV_OFFSET 0xcbf29ce484222325
+#define LEXER_FNV_PRIME 0x00000100000001B3
+
+// Character classes, a token keeps reading characters for as long as their class matches its mask.
+enum
+{
+	LEXER_CLASS_IDENTIFIER_START = 1, // a-z A-Z _
+	LEXER_CLASS_IDENTIFIER = 2,		  // a-z A-Z _ 0-9
+	LEXER_CLASS_DIGIT = 4,			  // 0-9
+	LEXER_CLASS_NUMBER = 8,			  // 0-9 a-f A-F . x, covers floats, hexadecimal and exponents
+	LEXER_CLASS_WHITESPACE = 16,	  // \r \n space \t
+	LEXER_CLASS_COMMENT = 32,		  // Anything but \r \n \0
+	LEXER_CLASS_BLANK = 64			  // \r space \t
+};
+
+#define LEXER_IS_ALPHA_(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') || (c) == '_')
+#define LEXER_IS_DIGIT_(c) ((c) >= '0' && (c) <= '9')
+#define LEXER_IS_HEX_(c) (((c) >= 'a' && (c) <= 'f') || ((c) >= 'A' && (c) <= 'F'))
+#define LEXER_CLASS_(c)                                                                                                \
+	((LEXER_IS_ALPHA_(c) ? LEXER_CLASS_IDENTIFIER_START : 0) |                                                         \
+	 (LEXER_IS_ALPHA_(c) || LEXER_IS_DIGIT_(c) ? LEXER_CLASS_IDENTIFIER : 0) |                                          \
+	 (LEXER_IS_DIGIT_(c) ? LEXER_CLASS_DIGIT : 0) |                                                                    \
+	 (LEXER_IS_DIGIT_(c) || LEXER_IS_HEX_(c) || (c) == '.' || (c) == 'x' ? LEXER_CLASS_NUMBER : 0) |                   \
+	 ((c) == '\r' || (c) == '\n' || (c) == ' ' || (c) == '\t' ? LEXER_CLASS_WHITESPACE : 0) |                          \
+	 ((c) != '\r' && (c) != '\n' && (c) != 0 ? LEXER_CLASS_COMMENT : 0) |                                            \
+	 ((c) == '\r' || (c) == ' ' || (c) == '\t' ? LEXER_CLASS_BLANK : 0))
+#define LEXER_CLASS_4_(c) LEXER_CLASS_(c), LEXER_CLASS_((c) + 1), LEXER_CLASS_((c) + 2), LEXER_CLASS_((c) + 3)
+#define LEXER_CLASS_16_(c) LEXER_CLASS_4_(c), LEXER_CLASS_4_((c) + 4), LEXER_CLASS_4_((c) + 8), LEXER_CLASS_4_((c) + 12)
+#define LEXER_CLASS_64_(c)                                                                                             \
+	LEXER_CLASS_16_(c), LEXER_CLASS_16_((c) + 16), LEXER_CLASS_16_((c) + 32), LEXER_CLASS_16_((c) + 48)
+
+static const u8 lexer_classes[256] = { LEXER_CLASS_64_(0), LEXER_CLASS_64_(64), LEXER_CLASS_64_(128), LEXER_CLASS_64_(192) };
+
+#define LEXER_DIGIT_(c)                                                                                                \
+	(LEXER_IS_DIGIT_(c)					 ? (c) - '0'                                                                   \
+	 : ((c) >= 'a' && (c) <= 'f')		 ? (c) - 'a' + 10                                                              \
+	 : ((c) >= 'A' && (c) <= 'F')		 ? (c) - 'A' + 10                                                              \
+										 : 0xff)
+#define LEXER_DIGIT_4_(c) LEXER_DIGIT_(c), LEXER_DIGIT_((c) + 1), LEXER_DIGIT_((c) + 2), LEXER_DIGIT_((c) + 3)
+#define LEXER_DIGIT_16_(c) LEXER_DIGIT_4_(c), LEXER_DIGIT_4_((c) + 4), LEXER_DIGIT_4_((c) + 8), LEXER_DIGIT_4_((c) + 12)
+#define LEXER_DIGIT_64_(c)                                                                                             \
+	LEXER_DIGIT_16_(c), LEXER_DIGIT_16_((c) + 16), LEXER_DIGIT_16_((c) + 32), LEXER_DIGIT_16_((c) + 48)
+
+static const u8 lexer_digits[256] = { LEXER_DIGIT_64_(0), LEXER_DIGIT_64_(64), LEXER_DIGIT_64_(128), LEXER_DIGIT_64_(192) };
+
+static inline u64 lexer_hash_span_(u64 hash, const u8 *p, const u8 *end)
 {
-	// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-	u64 prime = 0x00000100000001B3;
-	u64 offset = 0xcbf29ce484222325;
+	for(; p < end; ++p)
+		hash = (hash ^ *p) * LEXER_FNV_PRIME;
+	return hash;
+}
 
-	u64 hash = offset;
+// The hash the lexer computes for identifiers, it has nothing to do with the hash hg writes.
+LEXER_STATIC u64 lexer_hash(const void *data, size_t length)
+{
+	return lexer_hash_span_(LEXER_FNV_OFFSET, (const u8 *)data, (const u8 *)data + length);
+}
+
+static inline __attribute__((always_inline)) Token *lexer_read_string_(Lexer *lexer, Token *t, const int flags)
+{
+	u64 hash = LEXER_FNV_OFFSET;
 
 	t->token_type = TOKEN_TYPE_STRING;
 	// t->position = lexer->stream->tell(lexer->stream);
 	int n = 0;
 	int escaped = 0;
+	int single_line = flags & LEXER_FLAG_STRING_SINGLE_LINE;
+	if(lexer->buffer)
+	{
+		const u8 *start = lexer->buffer + *lexer->offset;
+		const u8 *end = lexer->buffer + lexer->length;
+		const u8 *p = start;
+		const u8 *stop;
+		while(1)
+		{
+			// Only quotes, backslashes, newlines and \0 need a closer look, anything else resets escaped.
+			const u8 *q = scan_string(p, end);
+			if(q != p)
+				escaped = 0;
+			p = q;
+			if(p == end || (*p == '\n' && single_line))
+			{
+				stop = p;
+				break;
+			}
+			u8 ch = *p++;
+			if(!ch || (ch == '"' && !escaped))
+			{
+				stop = p - 1;
+				break;
+			}
+			escaped = (!escaped && ch == '\\');
+		}
+		*lexer->offset = p - lexer->buffer;
+		t->hash = lexer_hash_span_(hash, start, stop);
+		t->length = stop - start;
+		return t;
+	}
 	while(1)
 	{
 		u8 ch = lexer_read_and_advance(lexer);
@@ -191,11 +383,16 @@ LEXER_STATIC Token *lexer_read_string(Lexer *lexer, Token *t)
 		{
 			break;
 		}
+		if(ch == '\n' && single_line)
+		{
+			lexer_unget(lexer);
+			break;
+		}
 		escaped = (!escaped && ch == '\\');
 		++n;
 
 		hash ^= ch;
-		hash *= prime;
+		hash *= LEXER_FNV_PRIME;
 	}
 	t->hash = hash;
 	t->length = n;
@@ -205,40 +402,100 @@ LEXER_STATIC Token *lexer_read_string(Lexer *lexer, Token *t)
 LEXER_STATIC Token *lexer_read_multiline_comment(Lexer *lexer, TokenType token_type, Token *t)
 {
 	t->token_type = token_type;
-	t->position = lexer->stream->tell(lexer->stream);
+	t->position = lexer_tell(lexer);
+	t->hash = 0;
 	int n = 0;
+	if(lexer->buffer)
+	{
+		const u8 *start = lexer->buffer + *lexer->offset;
+		const u8 *end = lexer->buffer + lexer->length;
+		const u8 *p = start;
+		while((p = scan_comment(p, end)) < end && *p && !(p + 1 < end && p[1] == '/'))
+			++p;
+		t->length = p - start;
+		if(p < end)
+			p += *p ? 2 : 1; // Skip the */ or the \0
+		*lexer->offset = p - lexer->buffer;
+		return t;
+	}
 	while(1)
 	{
 		u8 ch = lexer_read_and_advance(lexer);
 		if(!ch)
 			break;
-		if(ch == '*')
+		if(ch == '*' && lexer_peek(lexer) == '/')
 		{
-			u8 second = lexer_read_and_advance(lexer);
-			if(second == '/')
-			{
-				break;
-			}
-			lexer_unget(lexer);
+			lexer_read_and_advance(lexer);
+			break;
 		}
 		++n;
 	}
-	t->hash = 0;
 	t->length = n;
 	return t;
 }
 
-LEXER_STATIC Token *lexer_read_characters(Lexer *lexer, Token *t, TokenType token_type, int (*cond)(u8 ch, int *undo))
+// Reads characters for as long as their class is in mask, the first character that isn't is left in the stream.
+// A \0 ends the token as well, but it's consumed. Always inlined so every call site gets a loop for its own mask.
+static inline __attribute__((always_inline)) Token *
+lexer_read_characters_(Lexer *lexer, Token *t, TokenType token_type, u8 mask, u64 hash)
 {
-	// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
-	u64 prime = 0x00000100000001B3;
-	u64 offset = 0xcbf29ce484222325;
-
-	u64 hash = offset;
-
 	t->token_type = token_type;
-	t->position = lexer->stream->tell(lexer->stream);
+	t->position = lexer_tell(lexer);
+	if(lexer->buffer)
+	{
+		const u8 *start = lexer->buffer + *lexer->offset;
+		const u8 *end = lexer->buffer + lexer->length;
+		const u8 *p = start;
+		if(mask == LEXER_CLASS_COMMENT || mask == LEXER_CLASS_WHITESPACE)
+		{
+			p = mask == LEXER_CLASS_COMMENT ? scan_line(p, end) : scan_whitespace(p, end);
+			hash = lexer_hash_span_(hash, start, p);
+		}
+		else if(mask == LEXER_CLASS_NUMBER)
+		{
+			u32 base = 10;
+			if(end - p > 2 && p[0] == '0' && p[1] == 'x')
+			{
+				base = 16;
+				hash = lexer_hash_span_(hash, p, p + 2);
+				p += 2;
+			}
+			const u8 *digits = p;
+			u64 value = 0;
+			while(p < end && (lexer_classes[*p] & LEXER_CLASS_NUMBER))
+			{
+				u32 digit = lexer_digits[*p];
+				if(digit >= base || value > (UINT64_MAX - digit) / base)
+					base = 0; // '.', a second 'x', an exponent, a hexadecimal digit in a decimal number or overflow
+				else
+					value = value * base + digit;
+				hash = (hash ^ *p) * LEXER_FNV_PRIME;
+				++p;
+			}
+			// lexer_token_read_int only looks at the first 63 characters
+			if(p == digits || p - start > 63)
+				base = 0;
+			t->value = value;
+			t->base = base;
+			t->digits = base ? p - digits : 0;
+		}
+		else
+		{
+			while(p < end && (lexer_classes[*p] & mask))
+			{
+				hash = (hash ^ *p) * LEXER_FNV_PRIME;
+				++p;
+			}
+		}
+		t->length = p - start;
+		if(p < end && !*p)
+			++p;
+		*lexer->offset = p - lexer->buffer;
+		t->hash = hash;
+		return t;
+	}
 	int n = 0;
+	t->base = 0;
 	while(1)
 	{
 		u8 ch = lexer_read_and_advance(lexer);
@@ -247,77 +504,49 @@ LEXER_STATIC Token *lexer_read_characters(Lexer *lexer, Token *t, TokenType toke
 			// lexer_error(lexer, "Unexpected EOF");
 			break;
 		}
-		int undo = 0;
-		if(cond(ch, &undo))
+		if(!(lexer_classes[ch] & mask))
 		{
-			if(undo)
-			{
-				lexer_unget(lexer);
-			}
+			lexer_unget(lexer);
 			break;
 		}
 		++n;
 
 		hash ^= ch;
-		hash *= prime;
+		hash *= LEXER_FNV_PRIME;
 	}
 	t->hash = hash;
 	t->length = n;
 	return t;
 }
 
-LEXER_STATIC int cond_string(u8 ch, int *undo)
+static inline __attribute__((always_inline)) Token *lexer_read_characters(Lexer *lexer, Token *t, TokenType token_type, u8 mask)
 {
-	*undo = 0;
-	return ch == '"';
+	return lexer_read_characters_(lexer, t, token_type, mask, LEXER_FNV_OFFSET);
 }
-LEXER_STATIC int cond_numeric(u8 ch, int *undo)
-{
-	*undo = 1;
-
-	if(ch >= '0' && ch <= '9') // Decimal
-		return 0;
 
-	if(ch == '.' || ch == 'f') // Floating point and 'f' postfix
-		return 0;
-
-	if(ch == 'e') // Scientific notation
-		return 0;
-
-	if(ch == 'x') // Hexadecimal separator
-		return 0;
-
-	if(ch >= 'a' && ch <= 'f') // Hexadecimal
-		return 0;
-
-	if(ch >= 'A' && ch <= 'F') // Hexadecimal
-		return 0;
-
-	return 1;
-}
-LEXER_STATIC int cond_ident(u8 ch, int *undo)
-{
-	*undo = 1;
-	return !(ch >= 'a' && ch <= 'z') && !(ch >= 'A' && ch <= 'Z') && ch != '_' && !(ch >= '0' && ch <= '9');
-}
-LEXER_STATIC int cond_single_line_comment(u8 ch, int *undo)
-{
-	*undo = 1;
-	//\0 is implicitly handled by the if(!ch) check in lexer_read_characters
-	return ch == '\r' || ch == '\n';
-}
-LEXER_STATIC int cond_whitespace(u8 ch, int *undo)
-{
-	*undo = 1;
-	return ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t';
-}
+LEXER_STATIC Token *lexer_peek_token(Lexer *lexer, int n);
 
 LEXER_STATIC int lexer_accept(Lexer *lexer, TokenType tt, Token *t)
 {
 	Token _;
 	if(!t)
 		t = &_;
-	s64 pos = lexer->stream->tell(lexer->stream);
+	if(lexer->flags & LEXER_FLAG_LOOKAHEAD)
+	{
+		Token *next = lexer_peek_token(lexer, 0);
+		if(!next)
+		{
+			// Unexpected EOF
+			longjmp(lexer->jmp_error, 1);
+		}
+		*t = *next;
+		if(tt != t->token_type)
+			return 1;
+		lexer->ring_head = (lexer->ring_head + 1) % LEXER_LOOKAHEAD;
+		lexer->ring_count--;
+		return 0;
+	}
+	s64 pos = lexer_tell(lexer);
 	if(lexer_step(lexer, t))
 	{
 		// Unexpected EOF
@@ -326,7 +555,7 @@ LEXER_STATIC int lexer_accept(Lexer *lexer, TokenType tt, Token *t)
 	if(tt != t->token_type)
 	{
 		// Undo
-		lexer->stream->seek(lexer->stream, pos, SEEK_SET);
+		lexer_seek(lexer, pos);
 		return 1;
 	}
 	return 0;
@@ -355,66 +584,93 @@ LEXER_STATIC void lexer_expect(Lexer *lexer, TokenType tt, Token *t)
 	}
 }
 
-LEXER_STATIC int lexer_step(Lexer *lexer, Token *t)
+// The lexer proper. flags is a constant in every instantiation, see LEXER_INSTANTIATE, so the checks fold away.
+static inline __attribute__((always_inline)) int lexer_step_impl_(Lexer *lexer, Token *t, const int flags)
 {
 	s64 index;
 
 	t->next = NULL;
 	t->length = 1;
+	t->base = 0;
 
 	u8 ch = 0;
+	// Whitespace that isn't tokenized is skipped in one go instead of a lexer_step iteration per character.
+	u8 skip = 0;
+	if(!(flags & LEXER_FLAG_TOKENIZE_WHITESPACE))
+		skip = flags & LEXER_FLAG_TOKENIZE_NEWLINES ? LEXER_CLASS_BLANK : LEXER_CLASS_WHITESPACE;
 repeat:
-	index = lexer->stream->tell(lexer->stream);
+	if(lexer->buffer && skip)
+	{
+		const u8 *p = lexer->buffer + *lexer->offset;
+		const u8 *end = lexer->buffer + lexer->length;
+		// Most runs are a single space, only longer ones are worth a kernel call
+		if(p < end && (lexer_classes[*p] & skip))
+		{
+			++p;
+			if(p < end && (lexer_classes[*p] & skip))
+				p = skip == LEXER_CLASS_BLANK ? scan_blank(p, end) : scan_whitespace(p, end);
+		}
+		*lexer->offset = p - lexer->buffer;
+	}
+	index = lexer_tell(lexer);
 	t->position = index;
 
 	ch = lexer_read_and_advance(lexer);
 	if(!ch)
 		return 1;
-	t->hash = (0xcbf29ce484222325 ^ ch) * 0x00000100000001B3;
+	t->hash = (LEXER_FNV_OFFSET ^ ch) * LEXER_FNV_PRIME;
 	t->token_type = ch;
 	switch(ch)
 	{
 		case '"':
-			if(!(lexer->flags & LEXER_FLAG_STRING_RAW))
+			if(!(flags & LEXER_FLAG_STRING_RAW))
 			{
-				t->position = lexer->stream->tell(lexer->stream);
+				t->position = lexer_tell(lexer);
 			}
-			lexer_read_string(lexer, t);
-			if(lexer->flags & LEXER_FLAG_STRING_RAW)
+			lexer_read_string_(lexer, t, flags);
+			if(flags & LEXER_FLAG_STRING_RAW)
 			{
-				t->length = lexer->stream->tell(lexer->stream) - t->position;
+				t->length = lexer_tell(lexer) - t->position;
 			}
 			break;
 
 		case '-': // TODO: add lexer flag
-			if((lexer->flags & LEXER_FLAG_TREAT_NEGATIVE_SIGN_AS_NUMBER) == 0)
+			if((flags & LEXER_FLAG_TREAT_NEGATIVE_SIGN_AS_NUMBER) == 0)
 				return 0;
 		case '.':
 		{
-			ch = lexer_read_and_advance(lexer);
-			if(ch >= '0' && ch <= '9')
+			ch = lexer_peek(lexer);
+			if(!(lexer_classes[ch] & LEXER_CLASS_DIGIT))
+				break;
+			if(t->token_type == '-')
 			{
-				lexer_unget(lexer);
-				lexer_unget(lexer);
-				lexer_read_characters(lexer, t, TOKEN_TYPE_NUMBER, cond_numeric);
+				// The sign isn't a number character, it's put in front of the digits that follow
+				lexer_read_characters_(lexer, t, TOKEN_TYPE_NUMBER, LEXER_CLASS_NUMBER, t->hash);
+				t->position = index;
+				t->length++;
+				t->base = 0;
 			}
 			else
 			{
 				lexer_unget(lexer);
+				lexer_read_characters(lexer, t, TOKEN_TYPE_NUMBER, LEXER_CLASS_NUMBER);
 			}
 		}
 		break;
 
 		case '\n':
-			if(lexer->flags & LEXER_FLAG_TOKENIZE_NEWLINES)
+			if(flags & LEXER_FLAG_TOKENIZE_NEWLINES)
 				return 0;
 		case '\t':
 		case ' ':
 		case '\r':
-			if(lexer->flags & LEXER_FLAG_TOKENIZE_WHITESPACE)
+			if(flags & LEXER_FLAG_TOKENIZE_WHITESPACE)
 			{
-				if(lexer->flags & LEXER_FLAG_TOKENIZE_WHITESPACE_GROUPED)
-					lexer_read_characters(lexer, t, TOKEN_TYPE_WHITESPACE, cond_whitespace);
+				if(flags & LEXER_FLAG_TOKENIZE_WHITESPACE_GROUPED)
+				{
+					lexer_unget(lexer);
+					lexer_read_characters(lexer, t, TOKEN_TYPE_WHITESPACE, LEXER_CLASS_WHITESPACE);
+				}
 			}
 			else
 			{
@@ -423,36 +679,36 @@ repeat:
 			break;
 		case '/':
 		{
-			ch = lexer_read_and_advance(lexer);
-			if(!ch || (ch != '/' && ch != '*'))
+			ch = lexer_peek(lexer);
+			if(ch != '/' && ch != '*')
 			{
-				lexer_unget(lexer); // We'll get \0 the next time we call lexer_step
-				return 0;
+				return 0; // We'll get \0 the next time we call lexer_step
 			}
+			lexer_read_and_advance(lexer);
 			if(ch == '/')
-				lexer_read_characters(lexer, t, TOKEN_TYPE_COMMENT, cond_single_line_comment);
+				lexer_read_characters(lexer, t, TOKEN_TYPE_COMMENT, LEXER_CLASS_COMMENT);
 			else if(ch == '*')
 			{
-				if(lexer->flags & LEXER_FLAG_TOKEN_TYPE_MULTILINE_COMMENT_ENABLED)
+				if(flags & LEXER_FLAG_TOKEN_TYPE_MULTILINE_COMMENT_ENABLED)
 					lexer_read_multiline_comment(lexer, TOKEN_TYPE_MULTILINE_COMMENT, t);
 				else
 					lexer_read_multiline_comment(lexer, TOKEN_TYPE_COMMENT, t);
 			}
-			if(lexer->flags & LEXER_FLAG_SKIP_COMMENTS)
+			if(flags & LEXER_FLAG_SKIP_COMMENTS)
 				goto repeat;
 		}
 		break;
 		default:
 		{
-			if(ch >= '0' && ch <= '9')
+			if(lexer_classes[ch] & LEXER_CLASS_DIGIT)
 			{
 				lexer_unget(lexer);
-				lexer_read_characters(lexer, t, TOKEN_TYPE_NUMBER, cond_numeric);
+				lexer_read_characters(lexer, t, TOKEN_TYPE_NUMBER, LEXER_CLASS_NUMBER);
 			}
-			else if((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch == '_')
+			else if(lexer_classes[ch] & LEXER_CLASS_IDENTIFIER_START)
 			{
 				lexer_unget(lexer);
-				lexer_read_characters(lexer, t, TOKEN_TYPE_IDENTIFIER, cond_ident);
+				lexer_read_characters(lexer, t, TOKEN_TYPE_IDENTIFIER, LEXER_CLASS_IDENTIFIER);
 			}
 			else
 			{
@@ -469,10 +725,140 @@ repeat:
 	return 0;
 }
 
-LEXER_STATIC unsigned long long lexer_token_read_int(Lexer *lexer, Token *t)
+// Defines name, a lexer_step for one fixed set of flags in which every flag check is resolved at compile time, and
+// name##_init which sets the flags of a lexer and makes it use the variant.
+#define LEXER_INSTANTIATE(name, flags_)                                                                                \
+	static int name(Lexer *lexer, Token *t)                                                                            \
+	{                                                                                                                  \
+		return lexer_step_impl_(lexer, t, (flags_));                                                                   \
+	}                                                                                                                  \
+	static void name##_init(Lexer *lexer)                                                                              \
+	{                                                                                                                  \
+		lexer->flags = (flags_);                                                                                       \
+		lexer->step = name;                                                                                            \
+		lexer->step_flags = (flags_);                                                                                  \
+	}
+
+// Picks the lexer once per token, the variant if there is one for the current flags.
+LEXER_STATIC int lexer_read_token_(Lexer *lexer, Token *t)
+{
+	if(lexer->step && lexer->step_flags == lexer->flags)
+		return lexer->step(lexer, t);
+	return lexer_step_impl_(lexer, t, lexer->flags);
+}
+
+// Returns the n-th token that hasn't been consumed yet without consuming it, NULL at the end of the stream.
+// n has to be less than LEXER_LOOKAHEAD. Only valid with LEXER_FLAG_LOOKAHEAD, the token stays valid until it's consumed.
+LEXER_STATIC Token *lexer_peek_token(Lexer *lexer, int n)
+{
+	while(lexer->ring_count <= n)
+	{
+		int slot = (lexer->ring_head + lexer->ring_count) % LEXER_LOOKAHEAD;
+		s64 from = lexer_tell(lexer);
+		if(lexer_read_token_(lexer, &lexer->ring[slot]))
+		{
+			// Stay in front of the end, peeking again has to find it again
+			int count = lexer->ring_count;
+			lexer_seek(lexer, from);
+			lexer->ring_count = count;
+			return NULL;
+		}
+		lexer->ring_from[slot] = from;
+		lexer->ring_count++;
+	}
+	return &lexer->ring[(lexer->ring_head + n) % LEXER_LOOKAHEAD];
+}
+
+LEXER_STATIC int lexer_step(Lexer *lexer, Token *t)
+{
+	if(lexer->ring_count)
+	{
+		*t = lexer->ring[lexer->ring_head];
+		lexer->ring_head = (lexer->ring_head + 1) % LEXER_LOOKAHEAD;
+		lexer->ring_count--;
+		return 0;
+	}
+	return lexer_read_token_(lexer, t);
+}
+
+// A whole buffer worth of tokens as parallel arrays, so a pass over the tokens only touches the fields it needs.
+typedef struct
+{
+	u16 *types;
+	s64 *positions;
+	u16 *lengths;
+	u64 *hashes;
+	u64 *values; // Numbers only, see Token
+	u8 *bases;
+	u8 *digits;
+	size_t count, capacity;
+	Arena *arena;
+} TokenArray;
+
+// Returns false if the arena is out of memory.
+LEXER_STATIC bool token_array_init(TokenArray *tokens, Arena *arena, size_t capacity)
+{
+	tokens->arena = arena;
+	tokens->count = 0;
+	tokens->capacity = capacity ? capacity : 64;
+	tokens->types = arena_alloc(arena, tokens->capacity * sizeof(u16));
+	tokens->positions = arena_alloc(arena, tokens->capacity * sizeof(s64));
+	tokens->lengths = arena_alloc(arena, tokens->capacity * sizeof(u16));
+	tokens->hashes = arena_alloc(arena, tokens->capacity * sizeof(u64));
+	tokens->values = arena_alloc(arena, tokens->capacity * sizeof(u64));
+	tokens->bases = arena_alloc(arena, tokens->capacity);
+	tokens->digits = arena_alloc(arena, tokens->capacity);
+	return tokens->types && tokens->positions && tokens->lengths && tokens->hashes && tokens->values &&
+		   tokens->bases && tokens->digits;
+}
+
+// Leaves the tokens as they are if the arena is out of memory.
+static bool token_array_grow_(TokenArray *tokens)
+{
+	TokenArray grown = *tokens;
+	if(!token_array_init(&grown, tokens->arena, tokens->capacity * 2))
+		return false;
+	memcpy(grown.types, tokens->types, tokens->count * sizeof(u16));
+	memcpy(grown.positions, tokens->positions, tokens->count * sizeof(s64));
+	memcpy(grown.lengths, tokens->lengths, tokens->count * sizeof(u16));
+	memcpy(grown.hashes, tokens->hashes, tokens->count * sizeof(u64));
+	memcpy(grown.values, tokens->values, tokens->count * sizeof(u64));
+	memcpy(grown.bases, tokens->bases, tokens->count);
+	memcpy(grown.digits, tokens->digits, tokens->count);
+	grown.count = tokens->count;
+	*tokens = grown;
+	return true;
+}
+
+// Lexes everything up to the end of the stream into tokens, errors jump to jmp_error like lexer_step does and so
+// does running out of memory. Returns the number of tokens.
+LEXER_STATIC size_t lexer_tokenize(Lexer *lexer, TokenArray *tokens)
+{
+	Token t;
+	while(!lexer_step(lexer, &t))
+	{
+		if(tokens->count == tokens->capacity && !token_array_grow_(tokens))
+			longjmp(lexer->jmp_error, 1);
+		size_t i = tokens->count++;
+		tokens->types[i] = t.token_type;
+		tokens->positions[i] = t.position;
+		tokens->lengths[i] = t.length;
+		tokens->hashes[i] = t.hash;
+		tokens->values[i] = t.value;
+		tokens->bases[i] = t.base;
+		tokens->digits[i] = t.digits;
+	}
+	return tokens->count;
+}
+
+// Parses the text of a number token, which doesn't have to be \0 terminated. Only the first 63 characters count.
+LEXER_STATIC unsigned long long lexer_text_read_int(const u8 *text, size_t length)
 {
 	char str[64];
-	lexer_token_read_string(lexer, t, str, sizeof(str));
+	if(length > sizeof(str) - 1)
+		length = sizeof(str) - 1;
+	memcpy(str, text, length);
+	str[length] = 0;
 	char *x = strchr(str, 'x');
 	if(x)
 	{
@@ -481,6 +867,15 @@ LEXER_STATIC unsigned long long lexer_token_read_int(Lexer *lexer, Token *t)
 	return strtoull(str, NULL, 10);
 }
 
+LEXER_STATIC unsigned long long lexer_token_read_int(Lexer *lexer, Token *t)
+{
+	if(t->token_type == TOKEN_TYPE_NUMBER && t->base)
+		return t->value;
+	char str[64];
+	lexer_token_read_string(lexer, t, str, sizeof(str));
+	return lexer_text_read_int((const u8 *)str, strlen(str));
+}
+
 LEXER_STATIC int lexer_int(Lexer *l)
 {
 	Token t;
@@ -1,74 +1,255 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <inttypes.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "lexer.h"
 #include "stream.h"
 #include "stream_file.h"
 #include "stream_buffer.h"
+#include "thread_pool.h"
+#include "aho_corasick.h"
+#include "cache.h"
+#include "output.h"
+#include "hash.h"
+#include "collisions.h"
+#include "registry.h"
+#define HGSYM_WRITER
+#include "hgsym.h"
 
-// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+typedef struct Function_s
+{
+	const char *name;
+	size_t length;
+	u64 hash;
+	struct Function_s *next;
+} Function;
+
+// Open addressing with linear probing, keyed by the FNV-1a hash the lexer already computes for identifiers.
+typedef struct
+{
+	u64 hash;
+	Function *function;
+} FunctionSlot;
 
-static uint32_t fnv1a_32(const char *str)
+typedef struct
 {
-	uint32_t prime = 0x01000193;
-	uint32_t offset = 0x811c9dc5;
+	FunctionSlot *slots;
+	size_t mask;
+} FunctionTable;
 
-	uint32_t hash = offset;
-	while(*str)
-	{
-		hash ^= *str;
-		hash *= prime;
-		++str;
-	}
-	return hash;
-}
+typedef struct
+{
+	const char *path;
+	bool recursive;
+} Input;
+
+typedef struct
+{
+	Input *inputs;
+	int num_inputs;
+	const char **extensions;
+	int num_extensions;
+	Function *functions;
+	int num_functions;
+	size_t longest_function;
+	FunctionTable function_table;
+	AhoCorasick matcher;
+	bool use_matcher;
+	const HashAlgorithm *hash;
+	bool pad;
+	bool sync;
+	bool check; // Only report literals that are wrong, nothing is written
+	size_t chunk_size; // Larger files are streamed
+	int jobs;
+	const char *cache_path;
+	Cache cache;
+	u64 fingerprint;
+	CollisionIndex collisions; // Shared by all workers
+	const char *symbols_path;
+	const char *registry_path;
+	Registry registry; // Shared with other processes
+	size_t num_conflicts;
+	bool registry_full;
+} Options;
+
+typedef enum
+{
+	JOB_TYPE_FILE,
+	JOB_TYPE_DIRECTORY,
+	JOB_TYPE_CHUNK // A part of a large file, see FileStream
+} JobType;
+
+#define FUNCTION_MATCHER_THRESHOLD 8
+
+// The strings a file hashed, saved with its cache entry so they still take part in the collision check and
+// --symbols when the file is skipped the next time.
+typedef struct
+{
+	CacheHashed *strings;
+	size_t count, capacity;
+	Arena text;
+} HashedStrings;
+
+// Everything a file needs to report back, messages are printed in input order once all files are done.
+// Files found while walking a directory are ordered by path within the input they were found in.
+typedef struct
+{
+	JobType type;
+	int input_index;
+	char *path;
+	bool processed;
+	bool failed;
+	char *error;
+	bool has_record; // State of the file after this run, for the cache
+	CacheRecord record;
+	bool has_commit; // Written, but waiting for the group commit
+	OutputCommit commit;
+	size_t num_mismatches; // For --check
+	char *report;
+	HashedStrings hashed;
+} Job;
 
-static uint64_t fnv1a_64(const char *str)
+// Offsets of registered names in a buffer that aren't part of a longer identifier, sorted.
+typedef struct
+{
+	size_t *offsets;
+	size_t count, capacity;
+} Candidates;
+
+// A number literal of a call site.
+typedef struct
+{
+	size_t start, end;
+	u64 value;
+	int base, digits; // See Token
+} Literal;
+
+typedef struct
+{
+	size_t position;		 // Of the argument in the input
+	size_t argument, length; // The argument without quotes, in CallSites.strings
+	Literal literals[2];	 // One for every word of the hash
+} CallSite;
+
+// Call sites that have been matched but not rewritten yet, so their arguments can be hashed all at once.
+typedef struct
+{
+	CallSite *sites;
+	size_t count, capacity;
+	char *strings;
+	size_t strings_size, strings_capacity;
+	const char **arguments;
+	size_t *lengths;
+	u64 *hashes;
+	CollisionKey *keys, *scratch;
+	size_t batch_capacity;
+	HashedStrings *hashed; // Of the file that is processed, NULL if the cache isn't saved
+} CallSites;
+
+// Per thread state, buffers are reused for every file the worker picks up.
+typedef struct
+{
+	FILE *log;
+	char log_buffer[4096];
+	FILE *report; // The mismatches of the current file, for --check
+	char *report_buffer;
+	size_t report_size;
+	Output out;
+	Candidates candidates;
+	CallSites sites;
+	Arena arena; // Reset for every file
+} Worker;
+
+typedef struct
 {
-	uint64_t prime = 0x00000100000001B3;
-	uint64_t offset = 0xcbf29ce484222325;
+	Options *opts;
+	Worker *workers;
+	ThreadPool pool;
 
-	uint64_t hash = offset;
-	while(*str)
+	pthread_mutex_t jobs_mutex;
+	Job **jobs;
+	size_t num_jobs, max_jobs;
+} Context;
+
+static size_t function_slot_index(u64 hash, size_t mask)
+{
+	return (hash ^ (hash >> 32)) & mask;
+}
+
+static void hashed_strings_add(HashedStrings *h, const CollisionKey *key)
+{
+	if(h->count == h->capacity)
 	{
-		hash ^= *str;
-		hash *= prime;
-		++str;
+		h->capacity = h->capacity ? h->capacity * 2 : 64;
+		h->strings = realloc(h->strings, h->capacity * sizeof(CacheHashed));
 	}
-	return hash;
+	char *text = arena_alloc(&h->text, key->length);
+	memcpy(text, key->string, key->length);
+	CacheHashed *string = &h->strings[h->count++];
+	string->hash[0] = key->hash[0];
+	string->hash[1] = key->hash[1];
+	string->string = text;
+	string->length = key->length;
+	string->line = key->line;
 }
 
-typedef struct Function_s
+static void hashed_strings_free(HashedStrings *h)
 {
-	const char *name;
-	u64 hash;
-	struct Function_s *next;
-} Function;
+	free(h->strings);
+	arena_free(&h->text);
+	h->strings = NULL;
+	h->count = h->capacity = 0;
+}
 
-typedef struct
+static void function_table_init(FunctionTable *table, Function *functions)
 {
-	int input_index;
-	Function *functions;
-	int bits;
-} Options;
+	size_t count = 0;
+	for(Function *f = functions; f; f = f->next)
+		++count;
+	size_t capacity = 16;
+	while(capacity < count * 2)
+		capacity *= 2;
+	table->slots = calloc(capacity, sizeof(FunctionSlot));
+	table->mask = capacity - 1;
+	for(Function *f = functions; f; f = f->next)
+	{
+		size_t i = function_slot_index(f->hash, table->mask);
+		while(table->slots[i].function)
+		{
+			if(table->slots[i].hash == f->hash && !strcmp(table->slots[i].function->name, f->name))
+				break; // Registered more than once
+			i = (i + 1) & table->mask;
+		}
+		table->slots[i].hash = f->hash;
+		table->slots[i].function = f;
+	}
+}
 
-// Fast enough, could use a hash map or array (CPU go brrrr) instead though
-static Function *function_by_hash(Options *opts, uint64_t hash)
+// The hash only narrows it down, the name has to match as well so a collision can't cause a rewrite.
+static Function *function_by_hash(Options *opts, uint64_t hash, const u8 *name, size_t length)
 {
-	Function *f = opts->functions;
-	while(f)
+	FunctionTable *table = &opts->function_table;
+	size_t i = function_slot_index(hash, table->mask);
+	while(1)
 	{
-		if(f->hash == hash)
-			return f;
-		f = f->next;
+		FunctionSlot *slot = &table->slots[i];
+		if(!slot->function)
+			return NULL;
+		if(slot->hash == hash && slot->function->length == length && !memcmp(slot->function->name, name, length))
+			return slot->function;
+		i = (i + 1) & table->mask;
 	}
-	return NULL;
 }
 
 static const char *nextarg(int argc, const char **argv, int *i)
@@ -81,6 +262,49 @@ static const char *nextarg(int argc, const char **argv, int *i)
 	return argv[++(*i)];
 }
 
+static void add_function(Options *opts, const char *name)
+{
+	Function *f = malloc(sizeof(Function));
+	f->name = name;
+	f->length = strlen(f->name);
+	f->hash = lexer_hash(f->name, f->length);
+	f->next = opts->functions;
+	opts->functions = f;
+	opts->num_functions++;
+	if(f->length > opts->longest_function)
+		opts->longest_function = f->length;
+}
+
+// One name per line, leading and trailing whitespace is ignored as are empty lines and lines starting with #.
+static void load_functions_file(Options *opts, const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if(!fp)
+	{
+		fprintf(stderr, "Failed to open functions file '%s'\n", path);
+		exit(-1);
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	rewind(fp);
+	char *text = malloc(size + 1);
+	size = fread(text, 1, size, fp);
+	text[size] = 0;
+	fclose(fp);
+
+	for(char *line = strtok(text, "\r\n"); line; line = strtok(NULL, "\r\n"))
+	{
+		while(*line == ' ' || *line == '\t')
+			++line;
+		size_t n = strlen(line);
+		while(n > 0 && (line[n - 1] == ' ' || line[n - 1] == '\t'))
+			line[--n] = 0;
+		if(n == 0 || *line == '#')
+			continue;
+		add_function(opts, line);
+	}
+}
+
 static void parse_opts(int argc, const char **argv, Options *opts)
 {
 	for(int i = 1; i < argc; ++i)
@@ -89,251 +313,1570 @@ static void parse_opts(int argc, const char **argv, Options *opts)
 
 		if(!strcmp(opt, "-f"))
 		{
-			Function *f = malloc(sizeof(Function));
-			f->name = nextarg(argc, argv, &i);
-			f->hash = fnv1a_64(f->name);
-			f->next = opts->functions;
-			opts->functions = f;
+			add_function(opts, nextarg(argc, argv, &i));
+		}
+		else if(!strcmp(opt, "--functions-file"))
+		{
+			load_functions_file(opts, nextarg(argc, argv, &i));
 		}
 		else if(!strcmp(opt, "-b"))
 		{
-			opts->bits = atoi(nextarg(argc, argv, &i));
+			opts->hash = hash_find(atoi(nextarg(argc, argv, &i)) == 32 ? "fnv1a_32" : "fnv1a_64");
+		}
+		else if(!strcmp(opt, "-a"))
+		{
+			const char *name = nextarg(argc, argv, &i);
+			opts->hash = hash_find(name);
+			if(!opts->hash)
+			{
+				fprintf(stderr, "Unknown hash algorithm '%s', expected one of:", name);
+				for(size_t k = 0; k < sizeof(hash_algorithms) / sizeof(hash_algorithms[0]); ++k)
+					fprintf(stderr, " %s", hash_algorithms[k].name);
+				fprintf(stderr, "\n");
+				exit(-1);
+			}
+		}
+		else if(!strcmp(opt, "-p"))
+		{
+			opts->pad = true;
+		}
+		else if(!strcmp(opt, "--no-sync"))
+		{
+			opts->sync = false;
+		}
+		else if(!strcmp(opt, "-r"))
+		{
+			Input *input = &opts->inputs[opts->num_inputs++];
+			input->path = nextarg(argc, argv, &i);
+			input->recursive = true;
+		}
+		else if(!strcmp(opt, "-e"))
+		{
+			char *list = strdup(nextarg(argc, argv, &i));
+			for(char *ext = strtok(list, ","); ext; ext = strtok(NULL, ","))
+			{
+				opts->extensions = realloc(opts->extensions, (opts->num_extensions + 1) * sizeof(const char *));
+				opts->extensions[opts->num_extensions++] = ext;
+			}
+		}
+		else if(!strcmp(opt, "--check"))
+		{
+			opts->check = true;
+		}
+		else if(!strcmp(opt, "--symbols"))
+		{
+			opts->symbols_path = nextarg(argc, argv, &i);
+		}
+		else if(!strcmp(opt, "--registry"))
+		{
+			opts->registry_path = nextarg(argc, argv, &i);
+		}
+		else if(!strcmp(opt, "--cache"))
+		{
+			opts->cache_path = nextarg(argc, argv, &i);
+		}
+		else if(!strcmp(opt, "--chunk-size"))
+		{
+			char *suffix;
+			opts->chunk_size = strtoull(nextarg(argc, argv, &i), &suffix, 10);
+			if(*suffix == 'k' || *suffix == 'K')
+				opts->chunk_size <<= 10;
+			else if(*suffix == 'm' || *suffix == 'M')
+				opts->chunk_size <<= 20;
+			else if(*suffix == 'g' || *suffix == 'G')
+				opts->chunk_size <<= 30;
+			if(opts->chunk_size == 0)
+			{
+				fprintf(stderr, "Invalid chunk size '%s'\n", argv[i]);
+				exit(-1);
+			}
+		}
+		else if(!strcmp(opt, "-j"))
+		{
+			opts->jobs = atoi(nextarg(argc, argv, &i));
+			if(opts->jobs <= 0)
+				opts->jobs = sysconf(_SC_NPROCESSORS_ONLN);
 		}
 		else
 		{
-			if(opts->input_index == -1)
-				opts->input_index = i;
+			Input *input = &opts->inputs[opts->num_inputs++];
+			input->path = opt;
+			input->recursive = false;
+		}
+	}
+}
+
+static int size_compare(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a;
+	size_t y = *(const size_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int count_lines(const u8 *p, const u8 *end)
+{
+	int count = 0;
+	while((p = memchr(p, '\n', end - p)))
+	{
+		++count;
+		++p;
+	}
+	return count;
+}
+
+static int line_number_at(const u8 *data, size_t offset)
+{
+	return 1 + count_lines(data, data + offset);
+}
+
+static bool is_identifier_character(u8 ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_';
+}
+
+// Compares the first and last character of the name against 16 positions at once and only calls memcmp for the
+// positions where both match. https://0x80.pl/articles/simd-strfind.html
+static const u8 *find_name(const u8 *p, const u8 *end, const char *name, size_t length)
+{
+#if defined(__SSE2__)
+	if(length >= 2)
+	{
+		__m128i first = _mm_set1_epi8(name[0]);
+		__m128i last = _mm_set1_epi8(name[length - 1]);
+		while(end - p >= (ptrdiff_t)(length + 15))
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)p);
+			__m128i b = _mm_loadu_si128((const __m128i *)(p + length - 1));
+			unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+			while(mask)
+			{
+				int i = __builtin_ctz(mask);
+				if(!memcmp(p + i + 1, name + 1, length - 2))
+					return p + i;
+				mask &= mask - 1;
+			}
+			p += 16;
 		}
 	}
+#endif
+	if(p >= end)
+		return NULL;
+	return memmem(p, end - p, name, length);
 }
 
-static int read_line(Stream *s, char *line, size_t max_line_length, bool *carriage_return)
+static bool is_numeric_character(u8 ch)
 {
-	*carriage_return = false;
-	size_t n = 0;
-	line[n] = 0;
+	return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F') || ch == 'x' || ch == '.';
+}
 
-	int eol = 0;
-	int eof = 0;
-	size_t offset = 0;
-	while(!eol)
+// Whether the lexer starts a token at offset, e.g. "12RPC" is lexed as the number 12 followed by the identifier RPC.
+static bool is_token_start(const u8 *data, size_t offset)
+{
+	size_t i = offset;
+	while(i > 0 && (is_identifier_character(data[i - 1]) || data[i - 1] == '.'))
+		--i;
+	while(i < offset)
 	{
-		uint8_t ch = 0;
-		if(0 == s->read(s, &ch, 1, 1) || !ch)
+		u8 ch = data[i];
+		if((ch >= '0' && ch <= '9') || (ch == '.' && data[i + 1] >= '0' && data[i + 1] <= '9'))
 		{
-			// If we haven't read anything yet then this is the "real" EOF
-			// Had we encountered a \0 or EOF at the end of a line then it would have been one line too early
-			if(n == 0)
-				eof = 1;
-			break;
+			++i;
+			while(i < offset && is_numeric_character(data[i]))
+				++i;
+			if(i == offset)
+				return !is_numeric_character(data[i]);
 		}
-		if(n + 1 >= max_line_length) // n + 1 account for \0
+		else if(ch == '.')
 		{
-			fprintf(stderr, "Error line length %d is larger than the maximum length of a line.\n", max_line_length);
-			exit(-1);
+			++i;
 		}
-		switch(ch)
+		else
 		{
-			case '\r': *carriage_return = true; break;
-			case '\n': eol = 1; break;
-			default:
-				*carriage_return = false;
-				line[n++] = ch;
-				break;
+			while(i < offset && is_identifier_character(data[i]))
+				++i;
+			if(i == offset)
+				return false;
 		}
 	}
-	line[n] = 0;
-	return eof;
+	return true;
 }
 
-static void remove_quotes_in_place(char *str)
+static void add_candidate(Candidates *c, const u8 *data, size_t size, size_t offset, size_t length)
 {
-	size_t j = 0;
-	for(size_t i = 0; str[i]; i++)
+	if(offset > 0 && (is_identifier_character(data[offset - 1]) || data[offset - 1] == '.') &&
+	   !is_token_start(data, offset))
+		return;
+	if(offset + length < size && is_identifier_character(data[offset + length]))
+		return;
+	if(c->count == c->capacity)
 	{
-		if(str[i] != '\'' && str[i] != '"')
-			str[j++] = str[i];
+		c->capacity = c->capacity ? c->capacity * 2 : 64;
+		c->offsets = realloc(c->offsets, c->capacity * sizeof(size_t));
 	}
-	str[j] = 0;
+	c->offsets[c->count++] = offset;
 }
 
-static void process_line(Options *opts,
-						 const char *path,
-						 const char *line,
-						 int line_number,
-						 Stream *out,
-						 size_t *num_processed)
+typedef struct
 {
-	Stream s = { 0 };
-	StreamBuffer sb = { 0 };
-	init_stream_from_buffer(&s, &sb, (unsigned char *)line, strlen(line) + 1);
-	Lexer l = { 0 };
-	lexer_init(&l, NULL, &s);
-	l.out = stderr;
-	l.flags |= LEXER_FLAG_TOKENIZE_WHITESPACE;
-	l.flags |= LEXER_FLAG_TOKEN_TYPE_MULTILINE_COMMENT_ENABLED;
-	l.flags |= LEXER_FLAG_STRING_RAW;
-	if(setjmp(l.jmp_error))
+	Candidates *candidates;
+	const u8 *data;
+	size_t size;
+	size_t start, end;
+	const AhoCorasick *matcher;
+} CandidateSearch;
+
+static bool candidate_match(void *ctx, size_t offset, uint32_t pattern)
+{
+	CandidateSearch *search = ctx;
+	offset += search->start;
+	if(offset < search->end)
+		add_candidate(search->candidates, search->data, search->size, offset, search->matcher->lengths[pattern]);
+	return true;
+}
+
+// Finds the candidates that start in [start, end), the name itself may reach past end.
+// A handful of names is searched for one by one, beyond that a single pass of the Aho-Corasick automaton is faster.
+// Occurrences that stand on their own can't overlap, so the automaton reports them in order.
+static void find_candidates(Options *opts, const u8 *data, size_t size, size_t start, size_t end, Candidates *c)
+{
+	c->count = 0;
+	size_t limit = size - end > opts->longest_function ? end + opts->longest_function : size;
+	if(opts->use_matcher)
 	{
-		fprintf(stderr, "Error while parsing '%s' on line '%s'\n", path, line);
-		exit(-1);
+		CandidateSearch search = {
+			.candidates = c, .data = data, .size = size, .start = start, .end = end, .matcher = &opts->matcher
+		};
+		aho_corasick_search(&opts->matcher, data + start, limit - start, candidate_match, &search);
+		return;
 	}
-	Token t;
-	char temp[2048];
-	char string[2048];
-	while(!lexer_step(&l, &t))
+	for(Function *f = opts->functions; f; f = f->next)
 	{
-		char str[256];
-		if(t.token_type == '\n')
-			continue;
-		Function *f = NULL;
-		if(t.token_type == TOKEN_TYPE_IDENTIFIER)
-		{
-			f = function_by_hash(opts, t.hash);
-		}
-		lexer_token_read_string(&l, &t, temp, sizeof(temp));
-		if(t.token_type == TOKEN_TYPE_COMMENT)
+		const u8 *p = data + start;
+		while((p = find_name(p, data + limit, f->name, f->length)) && p < data + end)
 		{
-			stream_printf(out, "//%s", temp);
+			add_candidate(c, data, size, p - data, f->length);
+			p += f->length;
 		}
-		else if(t.token_type == TOKEN_TYPE_MULTILINE_COMMENT)
+	}
+	if(opts->num_functions > 1)
+	{
+		qsort(c->offsets, c->count, sizeof(size_t), size_compare);
+	}
+}
+
+static int string_compare(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Identifies everything that has an effect on the output, a cache written with other options can't be used.
+static u64 options_fingerprint(Options *opts)
+{
+	const char **names = malloc((opts->num_functions + 1) * sizeof(const char *));
+	int n = 0;
+	for(Function *f = opts->functions; f; f = f->next)
+		names[n++] = f->name;
+	qsort(names, n, sizeof(const char *), string_compare);
+	int format[] = { opts->hash->bits, opts->pad };
+	u64 hash = cache_hash(format, sizeof(format), 0);
+	hash = cache_hash(opts->hash->name, strlen(opts->hash->name) + 1, hash);
+	for(int i = 0; i < n; ++i)
+		hash = cache_hash(names[i], strlen(names[i]) + 1, hash);
+	free(names);
+	return hash;
+}
+
+static void matcher_init(Options *opts)
+{
+	opts->use_matcher = opts->num_functions > FUNCTION_MATCHER_THRESHOLD;
+	if(!opts->use_matcher)
+		return;
+	const char **names = malloc(opts->num_functions * sizeof(const char *));
+	size_t *lengths = malloc(opts->num_functions * sizeof(size_t));
+	int n = 0;
+	for(Function *f = opts->functions; f; f = f->next, ++n)
+	{
+		names[n] = f->name;
+		lengths[n] = f->length;
+	}
+	aho_corasick_build(&opts->matcher, names, lengths, n);
+	free(names);
+	free(lengths);
+}
+
+typedef enum
+{
+	SCAN_STATE_CODE,
+	SCAN_STATE_LINE_COMMENT,
+	SCAN_STATE_MULTILINE_COMMENT,
+	SCAN_STATE_STRING,
+	SCAN_STATE_EOF
+} ScanState;
+
+// Tracks whether a position is inside a comment or string without tokenizing, it follows the same rules the
+// lexer uses with the flags process_buffer sets. A \0 outside of a string or comment ends the input.
+typedef struct
+{
+	const u8 *data;
+	size_t size;
+	size_t offset;
+	ScanState state;
+	bool escaped;
+} Scanner;
+
+static ScanState scan_until(Scanner *s, size_t target)
+{
+	const u8 *data = s->data;
+	size_t i = s->offset;
+	if(target > s->size)
+		target = s->size;
+	while(i < target && s->state != SCAN_STATE_EOF)
+	{
+		// Jump to the next byte that can change the state
+		const u8 *p = data + i;
+		switch(s->state)
 		{
-			if(strlen(temp) > 0)
-				stream_printf(out, "/*%s*/", temp);
-			else
-				stream_printf(out, "/*");
+			case SCAN_STATE_CODE: p = scan_code(p, data + target); break;
+			case SCAN_STATE_LINE_COMMENT: p = scan_line(p, data + target); break;
+			case SCAN_STATE_MULTILINE_COMMENT: p = scan_comment(p, data + target); break;
+			case SCAN_STATE_STRING:
+				p = scan_string(p, data + target);
+				if(p != data + i)
+					s->escaped = false;
+				break;
+			default: break;
 		}
-		else
+		i = p - data;
+		if(i == target)
+			break;
+		u8 ch = data[i];
+		switch(s->state)
 		{
-			stream_printf(out, "%s", temp);
-		}
-		s64 save = s.tell(&s);
-		Token ts;
-		if(f)
-		{
-			l.flags &= ~LEXER_FLAG_TOKENIZE_WHITESPACE;
-			lexer_expect(&l, '(', NULL);
-			lexer_step(&l, &ts);
-			if(ts.token_type != TOKEN_TYPE_STRING && ts.token_type != TOKEN_TYPE_IDENTIFIER)
-				lexer_error(&l, "Expected string or identifier");
-			lexer_token_read_string(&l, &ts, string, sizeof(string));
-			lexer_expect(&l, ',', NULL);
-			Token tn;
-			if(!lexer_accept(&l, TOKEN_TYPE_NUMBER, &tn))
-			{
-				unsigned long long current_hash = lexer_token_read_int(&l, &tn);
-
-				if(opts->bits == 32)
-				{
-					if(fnv1a_32(string) == (uint32_t)current_hash)
-					{
-						goto skip;
-					}
-				}
-				else
+			case SCAN_STATE_CODE:
+				if(ch == '"')
 				{
-					if(fnv1a_64(string) == (uint64_t)current_hash)
-					{
-						goto skip;
-					}
+					s->state = SCAN_STATE_STRING;
+					s->escaped = false;
 				}
-
-				if(ts.token_type == TOKEN_TYPE_IDENTIFIER)
+				else if(ch == '/' && i + 1 < s->size && (data[i + 1] == '/' || data[i + 1] == '*'))
 				{
-					stream_printf(out, "(%s", string);
+					s->state = data[i + 1] == '/' ? SCAN_STATE_LINE_COMMENT : SCAN_STATE_MULTILINE_COMMENT;
+					++i;
 				}
-				else
+				else if(!ch)
 				{
-					remove_quotes_in_place(string);
-					stream_printf(out, "(\"%s\"", string);
+					s->state = SCAN_STATE_EOF;
 				}
-				if(opts->bits == 32)
+				break;
+			case SCAN_STATE_LINE_COMMENT:
+				if(ch == '\r' || ch == '\n')
+					s->state = SCAN_STATE_CODE;
+				else if(!ch)
+					s->state = SCAN_STATE_CODE;
+				break;
+			case SCAN_STATE_MULTILINE_COMMENT:
+				if(ch == '*' && i + 1 < s->size && data[i + 1] == '/')
 				{
-					stream_printf(out, ", 0x%" PRIx32 "", fnv1a_32(string));
+					s->state = SCAN_STATE_CODE;
+					++i;
 				}
+				else if(!ch)
+					s->state = SCAN_STATE_CODE;
+				break;
+			case SCAN_STATE_STRING:
+				if((ch == '"' && !s->escaped) || ch == '\n' || !ch)
+					s->state = SCAN_STATE_CODE;
 				else
-				{
-					stream_printf(out, ", 0x%" PRIx64 "", fnv1a_64(string));
-				}
-				*num_processed += 1;
-			}
-			else
-			{
-			skip:
-				s.seek(&s, save, SEEK_SET);
-			}
-
-			l.flags |= LEXER_FLAG_TOKENIZE_WHITESPACE;
+					s->escaped = !s->escaped && ch == '\\';
+				break;
+			default: break;
 		}
+		++i;
 	}
+	s->offset = i;
+	return s->state;
 }
 
-static bool sb_grow_(struct StreamBuffer_s *, size_t size)
+// The only flags hg lexes with, the second variant keeps tokens that are peeked at. Comments are skipped, a call
+// site may have them anywhere between its tokens.
+#define HG_LEXER_FLAGS                                                                                                 \
+	(LEXER_FLAG_SKIP_COMMENTS | LEXER_FLAG_TOKEN_TYPE_MULTILINE_COMMENT_ENABLED | LEXER_FLAG_STRING_RAW |              \
+	 LEXER_FLAG_STRING_SINGLE_LINE)
+LEXER_INSTANTIATE(lexer_step_tokenize, HG_LEXER_FLAGS)
+LEXER_INSTANTIATE(lexer_step_call_site, HG_LEXER_FLAGS | LEXER_FLAG_LOOKAHEAD)
+
+static Literal make_literal(const u8 *data, size_t position, size_t length, u64 value, int base, int digits)
 {
-	fprintf(stderr, "Out of memory, this shouldn't happen.");
-	exit(-1);
-	return false;
+	Literal literal = { position, position + length, base ? value : lexer_text_read_int(data + position, length), base, digits };
+	return literal;
 }
 
-static bool process_source_file(Options *opts, const char *path)
+// Quotes are left out of the argument, it's hashed without them.
+static CallSite *add_call_site(CallSites *s, const u8 *data, size_t position, size_t length)
 {
-	FILE *fp = fopen(path, "r");
-	if(!fp)
+	const u8 *argument = data + position;
+	if(s->count == s->capacity)
 	{
-		return false;
+		s->capacity = s->capacity ? s->capacity * 2 : 64;
+		s->sites = realloc(s->sites, s->capacity * sizeof(CallSite));
 	}
-	fseek(fp, 0, SEEK_END);
-	long size = ftell(fp);
-	rewind(fp);
-	Stream s_out = { 0 };
-	StreamBuffer sb_out = { 0 };
-	char *out_buf = malloc(size * 2);
-	memset(out_buf, 0, size * 2);
-	init_stream_from_buffer(&s_out, &sb_out, out_buf, size * 2);
-	sb_out.grow = sb_grow_;
-
-	Stream s = { 0 };
-	StreamFile sf = { 0 };
-	init_stream_from_file(&s, &sf, fp);
+	if(s->strings_size + length > s->strings_capacity)
+	{
+		s->strings_capacity = (s->strings_size + length) * 2;
+		s->strings = realloc(s->strings, s->strings_capacity);
+	}
+	CallSite *site = &s->sites[s->count++];
+	site->position = position;
+	site->argument = s->strings_size;
+	for(size_t i = 0; i < length; ++i)
+	{
+		if(argument[i] != '\'' && argument[i] != '"')
+			s->strings[s->strings_size++] = argument[i];
+	}
+	site->length = s->strings_size - site->argument;
+	return site;
+}
 
-	bool cr;
-	char line[2048];
-	int line_number = 0;
-	size_t num_processed = 0;
-	while(!read_line(&s, line, sizeof(line), &cr))
+// Inserts the strings that are new to this process into the registry, --check only looks them up. A conflict with a
+// string of this process is left to the collision index, it's reported once all files are done.
+static void register_strings(Options *opts, const CollisionKey *keys, size_t count, const char *path)
+{
+	for(size_t i = 0; i < count; ++i)
 	{
-		process_line(opts, path, line, line_number++, &s_out, &num_processed);
-		stream_printf(&s_out, "\n");
+		const CollisionKey *key = &keys[i];
+		if(!key->added)
+			continue;
+		char location[4096];
+		snprintf(location, sizeof(location), "%s:%d", path, key->line);
+		RegistryConflict conflict = { 0 };
+		RegistryResult result =
+			registry_insert(&opts->registry, key->hash, key->mixed, key->string, key->length, location, &conflict);
+		if(result == REGISTRY_FULL)
+		{
+			if(!__atomic_exchange_n(&opts->registry_full, true, __ATOMIC_RELAXED))
+				fprintf(stderr, "Registry '%s' is full, strings are no longer registered\n", opts->registry_path);
+			return;
+		}
+		if(result != REGISTRY_CONFLICT || conflict.writer == opts->registry.writer)
+			continue;
+		__atomic_fetch_add(&opts->num_conflicts, 1, __ATOMIC_RELAXED);
+		flockfile(stderr);
+		fprintf(stderr, "Hash collision ");
+		collision_print_hash(stderr, opts->hash->bits, key->hash);
+		fprintf(stderr,
+				": '%.*s' at %s and '%.*s' at %s (process %d)\n",
+				(int)key->length,
+				key->string,
+				location,
+				(int)conflict.length,
+				conflict.string,
+				conflict.location,
+				conflict.pid);
+		funlockfile(stderr);
 	}
-	fclose(fp);
-	if(num_processed > 0)
+}
+
+// Where the call sites of a buffer are, for the collision index. line is the number of the line that starts at
+// offset, the call sites are after it.
+typedef struct
+{
+	const char *path;
+	size_t offset;
+	int line;
+} SourceLocation;
+
+// Hashes the arguments of all call sites in one batch and adds them to the collision index. keys[i].line is the
+// line of call site i afterwards.
+static void reserve_batch(CallSites *s, size_t count)
+{
+	if(count > s->batch_capacity)
 	{
-		printf("Processing: '%s'\n", path);
-		fp = fopen(path, "w");
-		fwrite(out_buf, 1, strlen(out_buf), fp);
-		fclose(fp);
+		s->batch_capacity = count * 2;
+		s->arguments = realloc(s->arguments, s->batch_capacity * sizeof(const char *));
+		s->lengths = realloc(s->lengths, s->batch_capacity * sizeof(size_t));
+		s->hashes = realloc(s->hashes, s->batch_capacity * 2 * sizeof(u64));
+		s->keys = realloc(s->keys, s->batch_capacity * sizeof(CollisionKey));
+		s->scratch = realloc(s->scratch, s->batch_capacity * sizeof(CollisionKey));
 	}
-	return true;
 }
 
-int main(int argc, const char **argv, char **envp)
+static void hash_call_sites(Options *opts, CallSites *s, SourceLocation location, const u8 *data)
 {
-	Options opts = { .bits = 32, .input_index = -1, .functions = NULL };
-	parse_opts(argc, argv, &opts);
+	const HashAlgorithm *hash = opts->hash;
+	int words = hash_words(hash);
+	reserve_batch(s, s->count);
+	for(size_t i = 0; i < s->count; ++i)
+	{
+		s->arguments[i] = s->strings + s->sites[i].argument;
+		s->lengths[i] = s->sites[i].length;
+	}
+	hash->batch(s->arguments, s->lengths, s->count, s->hashes);
 
-	if(opts.input_index == -1)
+	// The call sites are in order, lines are only counted once
+	for(size_t i = 0; i < s->count; ++i)
 	{
-		fprintf(stderr, "No input files.\n");
-		exit(-1);
+		const CallSite *site = &s->sites[i];
+		location.line += count_lines(data + location.offset, data + site->position);
+		location.offset = site->position;
+		CollisionKey *key = &s->keys[i];
+		key->hash[0] = s->hashes[i * words];
+		key->hash[1] = words == 2 ? s->hashes[i * words + 1] : 0;
+		key->string = s->arguments[i];
+		key->length = s->lengths[i];
+		key->line = location.line;
+		if(s->hashed)
+			hashed_strings_add(s->hashed, key);
+	}
+	collision_index_insert(&opts->collisions, s->keys, s->count, location.path, s->scratch);
+	if(opts->registry_path)
+		register_strings(opts, s->scratch, s->count, location.path);
+}
+
+// A file the cache skips still takes part in the collision check, with the strings it hashed when it was processed.
+static void add_cached_strings(Options *opts, Worker *w, const char *path, const CacheEntry *entry)
+{
+	CallSites *s = &w->sites;
+	reserve_batch(s, entry->num_strings);
+	for(size_t i = 0; i < entry->num_strings; ++i)
+	{
+		CacheHashed string = cache_string(&opts->cache, entry, i);
+		CollisionKey *key = &s->keys[i];
+		key->hash[0] = string.hash[0];
+		key->hash[1] = string.hash[1];
+		key->string = string.string;
+		key->length = string.length;
+		key->line = string.line;
 	}
-	for(int i = opts.input_index; i < argc; ++i)
+	collision_index_insert(&opts->collisions, s->keys, entry->num_strings, path, s->scratch);
+	if(opts->registry_path)
+		register_strings(opts, s->scratch, entry->num_strings, path);
+}
+
+static bool literal_matches(const Options *opts, const Literal *literal, u64 value)
+{
+	u64 mask = opts->hash->bits == 32 ? 0xffffffff : ~(u64)0;
+	return (literal->value & mask) == value;
+}
+
+// Replaces every literal that isn't its word of the hash already. Only the literals are replaced, line breaks and
+// comments in the argument list stay where they are. The text up to each literal is copied to the output first,
+// *copied is where the untouched source continues.
+static void rewrite_call_sites(Options *opts,
+							   CallSites *s,
+							   SourceLocation location,
+							   const u8 *data,
+							   Output *out,
+							   size_t *copied,
+							   size_t *num_processed)
+{
+	hash_call_sites(opts, s, location, data);
+	int words = hash_words(opts->hash);
+	// Hashes are written as 0x%x, padded to the full width with -p
+	int width = opts->pad ? (opts->hash->bits == 32 ? 8 : 16) : 0;
+	for(size_t i = 0; i < s->count; ++i)
 	{
-		const char *path = argv[i];
-		if(!process_source_file(&opts, path))
+		bool rewritten = false;
+		for(int k = 0; k < words; ++k)
 		{
-			fprintf(stderr, "Failed to process '%s'\n", path);
-			exit(-1);
+			const Literal *literal = &s->sites[i].literals[k];
+			u64 value = s->hashes[i * words + k];
+			if(literal_matches(opts, literal, value))
+				continue;
+			char text[64];
+			int n = snprintf(text, sizeof(text), "0x%0*" PRIx64, width, value);
+			output_source(out, data + *copied, literal->start - *copied);
+			output_text(out, data + literal->start, literal->end - literal->start, text, n);
+			*copied = literal->end;
+			rewritten = true;
+		}
+		*num_processed += rewritten;
+	}
+	s->count = 0;
+	s->strings_size = 0;
+}
+
+// Reports every literal that isn't its word of the hash as path:line:column, for --check. Nothing is written.
+static void check_call_sites(Options *opts, CallSites *s, SourceLocation location, const u8 *data, FILE *report, size_t *num_mismatches)
+{
+	hash_call_sites(opts, s, location, data);
+	int words = hash_words(opts->hash);
+	for(size_t i = 0; i < s->count; ++i)
+	{
+		const CallSite *site = &s->sites[i];
+		for(int k = 0; k < words; ++k)
+		{
+			const Literal *literal = &site->literals[k];
+			u64 value = s->hashes[i * words + k];
+			if(literal_matches(opts, literal, value))
+				continue;
+			int line = s->keys[i].line + count_lines(data + site->position, data + literal->start);
+			const u8 *start = memrchr(data, '\n', literal->start);
+			size_t column = literal->start - (start ? start + 1 - data : 0) + 1;
+			fprintf(report,
+					"%s:%d:%zu: '%.*s' hashes to 0x%0*" PRIx64 ", found %.*s\n",
+					location.path,
+					line,
+					column,
+					(int)s->lengths[i],
+					s->arguments[i],
+					opts->hash->bits == 32 ? 8 : 16,
+					value,
+					(int)(literal->end - literal->start),
+					data + literal->start);
+			++*num_mismatches;
+		}
+	}
+	s->count = 0;
+	s->strings_size = 0;
+}
+
+// Consumes the next token if it has one of the types. Otherwise, or at the end of the input, it's left for the
+// next call site.
+static bool accept_either(Lexer *l, int a, int b, Token *t)
+{
+	Token *next = lexer_peek_token(l, 0);
+	if(!next || (next->token_type != a && next->token_type != b))
+		return false;
+	Token skipped;
+	lexer_step(l, t ? t : &skipped);
+	return true;
+}
+
+// Matches the call site after the identifier that was just read, a 128-bit hash has a literal for each half.
+// Anything that doesn't have the shape of a call site, like the declaration of the function, is left alone.
+static void process_call_site(Options *opts, Lexer *l, const u8 *data, CallSites *sites)
+{
+	Token ts, tn[2];
+	if(!accept_either(l, '(', '(', NULL) || !accept_either(l, TOKEN_TYPE_STRING, TOKEN_TYPE_IDENTIFIER, &ts) ||
+	   !accept_either(l, ',', ',', NULL) || !accept_either(l, TOKEN_TYPE_NUMBER, TOKEN_TYPE_NUMBER, &tn[0]))
+		return;
+	int words = hash_words(opts->hash);
+	if(words == 2 && (!accept_either(l, ',', ',', NULL) || !accept_either(l, TOKEN_TYPE_NUMBER, TOKEN_TYPE_NUMBER, &tn[1])))
+		return;
+	CallSite *site = add_call_site(sites, data, ts.position, ts.length);
+	for(int k = 0; k < words; ++k)
+		site->literals[k] = make_literal(data, tn[k].position, tn[k].length, tn[k].value, tn[k].base, tn[k].digits);
+}
+
+// Index of the first identifier at or after i, the types are compared 8 at a time.
+static size_t next_identifier(const u16 *types, size_t i, size_t count)
+{
+#if defined(__SSE2__)
+	__m128i identifier = _mm_set1_epi16(TOKEN_TYPE_IDENTIFIER);
+	for(; i + 8 <= count; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(types + i));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi16(v, identifier));
+		if(mask)
+			return i + __builtin_ctz(mask) / 2;
+	}
+#endif
+	while(i < count && types[i] != TOKEN_TYPE_IDENTIFIER)
+		++i;
+	return i;
+}
+
+// Lexes the whole buffer into a token array once and matches IDENTIFIER '(' IDENTIFIER|STRING ',' NUMBER on it,
+// comments are already gone. Gives up without any output if the buffer doesn't lex or its tokens don't fit in
+// memory, the candidate path then takes over and reports a lexer error exactly where it is.
+static bool process_tokens(Options *opts, Worker *w, const char *path, const u8 *data, size_t size, size_t *num_processed)
+{
+	Stream s = { 0 };
+	StreamBuffer sb = { 0 };
+	init_stream_from_buffer(&s, &sb, (unsigned char *)data, size);
+	Lexer l = { 0 };
+	lexer_init(&l, NULL, &s);
+	l.out = w->log;
+	lexer_step_tokenize_init(&l);
+	long mark = ftell(w->log);
+	arena_reset(&w->arena);
+	// Grows with the tokens, so the arena that's kept for the next buffer is only as big as this one needed
+	TokenArray tokens;
+	if(!token_array_init(&tokens, &w->arena, 4096))
+		return false;
+	if(setjmp(l.jmp_error))
+	{
+		fseek(w->log, mark, SEEK_SET);
+		return false;
+	}
+	size_t count = lexer_tokenize(&l, &tokens);
+
+	const u16 *types = tokens.types;
+	int words = hash_words(opts->hash);
+	w->sites.count = 0;
+	w->sites.strings_size = 0;
+	Output *out = &w->out;
+	output_reset(out);
+	size_t copied = 0;
+	size_t processed = 0;
+	for(size_t i = 0; (i = next_identifier(types, i, count)) < count;)
+	{
+		if(!function_by_hash(opts, tokens.hashes[i], data + tokens.positions[i], tokens.lengths[i]))
+		{
+			++i;
+			continue;
+		}
+		// The same shape process_call_site accepts, matching continues at the first token that doesn't fit
+		size_t k = i + 1;
+		if(k >= count || types[k] != '(' || ++k >= count ||
+		   (types[k] != TOKEN_TYPE_STRING && types[k] != TOKEN_TYPE_IDENTIFIER) || ++k >= count || types[k] != ',' ||
+		   ++k >= count || types[k] != TOKEN_TYPE_NUMBER ||
+		   (words == 2 && (++k >= count || types[k] != ',' || ++k >= count || types[k] != TOKEN_TYPE_NUMBER)))
+		{
+			i = k;
+			continue;
+		}
+		size_t argument = i + 2;
+		CallSite *site = add_call_site(&w->sites, data, tokens.positions[argument], tokens.lengths[argument]);
+		for(int n = 0; n < words; ++n)
+		{
+			size_t number = argument + 2 + n * 2;
+			site->literals[n] = make_literal(data,
+											 tokens.positions[number],
+											 tokens.lengths[number],
+											 tokens.values[number],
+											 tokens.bases[number],
+											 tokens.digits[number]);
+		}
+		i = k + 1;
+	}
+	SourceLocation location = { path, 0, 1 };
+	if(opts->check)
+	{
+		check_call_sites(opts, &w->sites, location, data, w->report, num_processed);
+		return true;
+	}
+	rewrite_call_sites(opts, &w->sites, location, data, out, &copied, &processed);
+	if(processed > 0)
+		output_source(out, data + copied, size - copied);
+	*num_processed += processed;
+	return true;
+}
+
+#define TOKENIZE_DENSITY 16
+
+// Collects the call sites among the candidates, see rewrite_call_sites. *resume is where the lexer stopped after the
+// previous call site, candidates before it have already been consumed. Returns false once the end of the input is
+// reached.
+static bool process_candidates(Options *opts,
+							   Lexer *l,
+							   Scanner *scanner,
+							   const Candidates *candidates,
+							   const u8 *data,
+							   CallSites *sites,
+							   size_t *resume)
+{
+	// A lexer error can leave the call sites of an earlier buffer behind
+	sites->count = 0;
+	sites->strings_size = 0;
+	for(size_t i = 0; i < candidates->count; ++i)
+	{
+		size_t offset = candidates->offsets[i];
+		if(offset < *resume) // Already consumed by the previous call site
+			continue;
+		ScanState state = scan_until(scanner, offset);
+		if(state == SCAN_STATE_EOF)
+			return false;
+		if(state != SCAN_STATE_CODE)
+			continue;
+		Token t;
+		lexer_seek(l, offset);
+		lexer_step(l, &t);
+		if(t.token_type == TOKEN_TYPE_IDENTIFIER && function_by_hash(opts, t.hash, data + t.position, t.length))
+			process_call_site(opts, l, data, sites);
+		*resume = lexer_offset(l);
+	}
+	return true;
+}
+
+// Only the neighbourhood of each candidate is lexed, a buffer without any candidates isn't lexed at all and nothing
+// is written to the output. Everything that isn't a rewritten call site is copied through as is.
+static bool process_buffer(Options *opts, Worker *w, const char *path, const u8 *data, size_t size, size_t *num_processed)
+{
+	Candidates *candidates = &w->candidates;
+	find_candidates(opts, data, size, 0, size, candidates);
+	if(candidates->count == 0)
+		return true;
+	// With call sites this dense, lexing everything once beats lexing around every candidate
+	if(candidates->count * TOKENIZE_DENSITY >= size && process_tokens(opts, w, path, data, size, num_processed))
+		return true;
+
+	Stream s = { 0 };
+	StreamBuffer sb = { 0 };
+	init_stream_from_buffer(&s, &sb, (unsigned char *)data, size);
+	Lexer l = { 0 };
+	lexer_init(&l, NULL, &s);
+	l.out = w->log;
+	lexer_step_call_site_init(&l);
+	if(setjmp(l.jmp_error))
+	{
+		fprintf(w->log, "Error while parsing '%s' on line %d\n", path, line_number_at(data, lexer_offset(&l)));
+		return false;
+	}
+	Output *out = &w->out;
+	output_reset(out);
+	Scanner scanner = { .data = data, .size = size, .state = SCAN_STATE_CODE };
+	size_t copied = 0;
+	size_t resume = 0;
+	process_candidates(opts, &l, &scanner, candidates, data, &w->sites, &resume);
+	SourceLocation location = { path, 0, 1 };
+	if(opts->check)
+	{
+		check_call_sites(opts, &w->sites, location, data, w->report, num_processed);
+		return true;
+	}
+	rewrite_call_sites(opts, &w->sites, location, data, out, &copied, num_processed);
+	if(*num_processed > 0)
+		output_source(out, data + copied, size - copied);
+	return true;
+}
+
+#define STREAM_CHUNK_SIZE (16 << 20)
+
+// Gives back the pages of the mapping before end that haven't been given back yet. They're read from the file once
+// more if they are touched again after all.
+static void drop_pages(const u8 *data, size_t *dropped, size_t end)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	end &= ~(page_size - 1);
+	if(end > *dropped)
+	{
+		madvise((u8 *)data + *dropped, end - *dropped, MADV_DONTNEED);
+		*dropped = end;
+	}
+}
+
+static void set_record(Job *job, u64 size, s64 mtime, u64 content_hash)
+{
+	job->has_record = true;
+	job->record.path = job->path;
+	job->record.size = size;
+	job->record.mtime = mtime;
+	job->record.content_hash = content_hash;
+	job->record.hashed = job->hashed.strings;
+	job->record.num_hashed = job->hashed.count;
+	job->record.previous = NULL;
+}
+
+// The file is unchanged, it keeps the strings of its cache entry.
+static void set_cached_record(Options *opts, Worker *w, Job *job, u64 size, s64 mtime, const CacheEntry *entry)
+{
+	add_cached_strings(opts, w, job->path, entry);
+	set_record(job, size, mtime, entry->content_hash);
+	job->record.previous = entry;
+}
+
+// A file that's larger than the chunk size, split at line breaks that are outside of comments and strings. The
+// chunks are processed by the workers in any order, at most STREAM_CHUNKS_PER_WORKER per worker at a time. The
+// worker that finishes a chunk writes every chunk that's ready in order, whoever finishes the last one completes
+// the job. Memory use depends on the chunk size and the number of workers, not on the size of the file.
+#define STREAM_CHUNKS_PER_WORKER 2
+
+struct FileStream_s;
+
+typedef struct
+{
+	Job job; // JOB_TYPE_CHUNK, this is what the thread pool runs
+	struct FileStream_s *stream;
+	size_t start, end;
+	int line;			  // Of start
+	size_t from, covered; // The output is for [from, covered), covered may be past end
+	size_t resume;		  // Where the lexer stopped after the last call site
+	size_t num_processed;
+	Output out;
+	bool done;
+	bool ok;
+	char *error;
+	HashedStrings hashed;
+} StreamChunk;
+
+typedef struct FileStream_s
+{
+	Job *job;
+	const u8 *data;
+	size_t size;
+	struct stat st;
+	StreamChunk *chunks;
+	size_t num_chunks;
+
+	pthread_mutex_t mutex;
+	size_t next_submit, next_write, in_flight;
+	bool writing;
+	bool finished;
+
+	// Only touched by the worker that is writing
+	bool failed;
+	char *error;
+	size_t copied, resume, dropped;
+	size_t num_processed;
+	int fd;
+	char *temp;
+	char *target; // See output_target
+	CacheHasher hasher;
+	u64 content_hash;
+} FileStream;
+
+// Processes the candidates in [chunk->start, chunk->end). Every chunk is first processed on its own, as if no call
+// site of the chunks before it reached into it. If one did, the chunk is processed again with the real copied and
+// resume, which is what a single pass over the whole file would have had at that point.
+static bool process_chunk(Options *opts, Worker *w, FileStream *fs, StreamChunk *chunk, size_t copied, size_t resume)
+{
+	const u8 *data = fs->data;
+	Stream s = { 0 };
+	StreamBuffer sb = { 0 };
+	init_stream_from_buffer(&s, &sb, (unsigned char *)data, fs->size);
+	Lexer l = { 0 };
+	lexer_init(&l, NULL, &s);
+	l.out = w->log;
+	lexer_step_call_site_init(&l);
+	Output *out = &chunk->out;
+	output_reset(out);
+	chunk->from = copied;
+	chunk->num_processed = 0;
+	chunk->hashed.count = 0;
+	arena_reset(&chunk->hashed.text);
+	w->sites.hashed = opts->cache_path && !opts->check ? &chunk->hashed : NULL;
+	if(setjmp(l.jmp_error))
+	{
+		fprintf(w->log,
+				"Error while parsing '%s' on line %d\n",
+				fs->job->path,
+				line_number_at(data, lexer_offset(&l)));
+		fflush(w->log);
+		free(chunk->error);
+		chunk->error = strndup(w->log_buffer, ftell(w->log));
+		return false;
+	}
+	find_candidates(opts, data, fs->size, chunk->start, chunk->end, &w->candidates);
+	// The chunk starts at the beginning of a line outside of comments and strings
+	Scanner scanner = { .data = data, .size = fs->size, .offset = chunk->start, .state = SCAN_STATE_CODE };
+	size_t end = chunk->end;
+	bool more = process_candidates(opts, &l, &scanner, &w->candidates, data, &w->sites, &resume);
+	SourceLocation location = { fs->job->path, chunk->start, chunk->line };
+	rewrite_call_sites(opts, &w->sites, location, data, out, &copied, &chunk->num_processed);
+	if(!more)
+		end = fs->size; // The rest is copied as is
+	if(end < copied)
+		end = copied;
+	output_source(out, data + copied, end - copied);
+	chunk->covered = end;
+	chunk->resume = resume;
+	return true;
+}
+
+// Called by the only worker that is writing, the chunks before this one have been written.
+static void stream_write_chunk_(Options *opts, Worker *w, FileStream *fs, StreamChunk *chunk)
+{
+	if(fs->failed || fs->copied >= fs->size)
+		return; // Discarded, the file failed or ended before this chunk
+	if(chunk->from != fs->copied || fs->resume > chunk->start)
+	{
+		rewind(w->log);
+		chunk->ok = process_chunk(opts, w, fs, chunk, fs->copied, fs->resume);
+	}
+	if(!chunk->ok)
+	{
+		fs->failed = true;
+		fs->error = chunk->error;
+		chunk->error = NULL;
+		return;
+	}
+	fs->copied = chunk->covered;
+	fs->resume = chunk->resume;
+	fs->num_processed += chunk->num_processed;
+	for(size_t i = 0; i < chunk->hashed.count; ++i)
+	{
+		const CacheHashed *h = &chunk->hashed.strings[i];
+		CollisionKey key = { { h->hash[0], h->hash[1] }, 0, h->string, h->length, h->line, false };
+		hashed_strings_add(&fs->job->hashed, &key);
+	}
+	if(fs->num_processed > 0)
+	{
+		Output *out = &chunk->out;
+		if(fs->fd == -1)
+		{
+			// Nothing has been written before the first call site that is rewritten
+			fs->target = output_target(fs->job->path);
+			fs->fd = fs->target ? output_create_temp(fs->target, &fs->st, &fs->temp) : -1;
+			Output *head = &w->out;
+			output_reset(head);
+			output_source(head, fs->data, chunk->from);
+			if(fs->fd == -1 || !output_writev(head, fs->fd))
+			{
+				fs->failed = true;
+				return;
+			}
+			if(opts->cache_path)
+				cache_hasher_update(&fs->hasher, fs->data, chunk->from);
+		}
+		if(opts->cache_path)
+		{
+			for(size_t i = 0; i < out->num_spans; ++i)
+				cache_hasher_update(&fs->hasher, output_span_data(out, &out->spans[i]), out->spans[i].length);
+		}
+		if(!output_writev(out, fs->fd))
+		{
+			fs->failed = true;
+			return;
+		}
+	}
+	// Everything before copied has been written, unless nothing has been rewritten yet
+	drop_pages(fs->data, &fs->dropped, fs->copied);
+}
+
+// Called with the mutex held.
+static void stream_submit_(Context *c, FileStream *fs)
+{
+	size_t window = (size_t)c->opts->jobs * STREAM_CHUNKS_PER_WORKER;
+	while(!fs->failed && fs->next_submit < fs->num_chunks && fs->next_submit < fs->next_write + window)
+	{
+		fs->in_flight++;
+		thread_pool_submit(&c->pool, &fs->chunks[fs->next_submit++].job);
+	}
+}
+
+static void stream_finish_(Context *c, FileStream *fs)
+{
+	Options *opts = c->opts;
+	Job *job = fs->job;
+	bool ok = !fs->failed;
+	bool copy = fs->st.st_nlink > 1;
+	if(fs->fd != -1)
+	{
+		ok = !fstat(fs->fd, &fs->st) && ok;
+		ok = !close(fs->fd) && ok;
+	}
+	if(fs->temp && ok && !opts->sync)
+	{
+		ok = output_install(fs->temp, fs->target, copy, &fs->st);
+		free(fs->temp);
+		fs->temp = NULL;
+	}
+	if(fs->temp && !ok)
+	{
+		unlink(fs->temp);
+		free(fs->temp);
+		fs->temp = NULL;
+	}
+	if(fs->num_processed > 0)
+	{
+		job->commit.temp = fs->temp;
+		job->has_commit = ok && opts->sync;
+		job->commit.path = fs->target;
+		job->commit.copy = copy;
+		fs->target = NULL;
+		job->commit.dev = fs->st.st_dev;
+		job->processed = ok;
+		if(opts->cache_path)
+			fs->content_hash = cache_hasher_final(&fs->hasher);
+	}
+	if(ok)
+	{
+		set_record(job, fs->st.st_size, cache_mtime(&fs->st), fs->content_hash);
+	}
+	else
+	{
+		job->failed = true;
+		job->error = fs->error;
+		fs->error = NULL;
+	}
+	munmap((u8 *)fs->data, fs->size);
+	for(size_t i = 0; i < fs->num_chunks; ++i)
+	{
+		output_free(&fs->chunks[i].out);
+		free(fs->chunks[i].error);
+		hashed_strings_free(&fs->chunks[i].hashed);
+	}
+	free(fs->chunks);
+	free(fs->error);
+	free(fs->target);
+	pthread_mutex_destroy(&fs->mutex);
+	free(fs);
+}
+
+static void process_chunk_job(Context *c, Worker *w, StreamChunk *chunk)
+{
+	FileStream *fs = chunk->stream;
+	rewind(w->log);
+	chunk->ok = process_chunk(c->opts, w, fs, chunk, chunk->start, chunk->start);
+
+	pthread_mutex_lock(&fs->mutex);
+	chunk->done = true;
+	fs->in_flight--;
+	if(fs->writing)
+	{
+		// The worker that is writing picks the chunk up
+		pthread_mutex_unlock(&fs->mutex);
+		return;
+	}
+	fs->writing = true;
+	while(fs->next_write < fs->num_chunks && fs->chunks[fs->next_write].done)
+	{
+		StreamChunk *next = &fs->chunks[fs->next_write];
+		pthread_mutex_unlock(&fs->mutex);
+		stream_write_chunk_(c->opts, w, fs, next);
+		output_free(&next->out);
+		pthread_mutex_lock(&fs->mutex);
+		fs->next_write++;
+		stream_submit_(c, fs);
+	}
+	fs->writing = false;
+	bool finish = !fs->finished && fs->in_flight == 0 && (fs->failed || fs->next_write == fs->num_chunks);
+	if(finish)
+		fs->finished = true;
+	pthread_mutex_unlock(&fs->mutex);
+	if(finish)
+		stream_finish_(c, fs);
+}
+
+// Splits the file and hands the chunks to the workers, the job is completed by whichever worker finishes the last
+// chunk. Takes over the mapping.
+static void start_stream(Context *c, Job *job, const u8 *data, size_t size, const struct stat *st, u64 content_hash)
+{
+	Options *opts = c->opts;
+	FileStream *fs = calloc(1, sizeof(FileStream));
+	fs->job = job;
+	fs->data = data;
+	fs->size = size;
+	fs->st = *st;
+	fs->fd = -1;
+	fs->content_hash = content_hash;
+	cache_hasher_init(&fs->hasher, 0);
+	pthread_mutex_init(&fs->mutex, NULL);
+
+	// A chunk ends at the first line break after chunk_size bytes where the scanner is in code
+	size_t capacity = size / opts->chunk_size + 1;
+	fs->chunks = calloc(capacity, sizeof(StreamChunk));
+	Scanner scanner = { .data = data, .size = size, .state = SCAN_STATE_CODE };
+	size_t dropped = 0;
+	size_t start = 0;
+	int line = 1;
+	while(start < size)
+	{
+		size_t end = size;
+		if(size - start > opts->chunk_size && fs->num_chunks + 1 < capacity)
+		{
+			scan_until(&scanner, start + opts->chunk_size);
+			while(scanner.state != SCAN_STATE_EOF && scanner.offset < size)
+			{
+				const u8 *newline = memchr(data + scanner.offset, '\n', size - scanner.offset);
+				if(!newline)
+					break;
+				size_t next = newline + 1 - data;
+				if(scan_until(&scanner, next) == SCAN_STATE_CODE && scanner.offset == next)
+				{
+					end = next;
+					break;
+				}
+			}
+		}
+		StreamChunk *chunk = &fs->chunks[fs->num_chunks++];
+		chunk->job.type = JOB_TYPE_CHUNK;
+		arena_init(&chunk->hashed.text, 16 << 10);
+		chunk->stream = fs;
+		chunk->start = start;
+		chunk->end = end;
+		chunk->line = line;
+		line += count_lines(data + start, data + end);
+		if(end < size)
+			drop_pages(data, &dropped, scanner.offset);
+		start = end;
+	}
+
+	pthread_mutex_lock(&fs->mutex);
+	stream_submit_(c, fs);
+	pthread_mutex_unlock(&fs->mutex);
+}
+
+static bool process_source_file(Context *c, Worker *w, Job *job)
+{
+	Options *opts = c->opts;
+	const char *path = job->path;
+	const CacheEntry *entry = NULL;
+	struct stat st;
+	if(opts->cache_path)
+	{
+		// Only a stat for files that haven't changed since the last run
+		if(stat(path, &st) == -1)
+			return false;
+		entry = cache_find(&opts->cache, path);
+		if(entry && cache_entry_is_current(&opts->cache, entry, &st))
+		{
+			set_cached_record(opts, w, job, entry->size, entry->mtime, entry);
+			return true;
+		}
+	}
+	int fd = open(path, O_RDONLY);
+	if(fd == -1)
+	{
+		return false;
+	}
+	if(fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	if(size == 0)
+	{
+		close(fd);
+		set_record(job, 0, cache_mtime(&st), cache_hash(NULL, 0, 0));
+		return true;
+	}
+	u8 *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	u64 content_hash = 0;
+	if(opts->cache_path)
+	{
+		// Touched, but the contents may still be the same. A file that's streamed is hashed chunk by chunk.
+		CacheHasher h;
+		cache_hasher_init(&h, 0);
+		size_t dropped = 0;
+		for(size_t i = 0; i < size;)
+		{
+			size_t end = size - i > opts->chunk_size ? i + opts->chunk_size : size;
+			cache_hasher_update(&h, data + i, end - i);
+			if(size > opts->chunk_size)
+				drop_pages(data, &dropped, end);
+			i = end;
+		}
+		content_hash = cache_hasher_final(&h);
+		if(entry && entry->size == size && entry->content_hash == content_hash)
+		{
+			munmap(data, size);
+			set_cached_record(opts, w, job, size, cache_mtime(&st), entry);
+			return true;
+		}
+	}
+
+	// Nothing is written with --check, the whole file is looked at at once
+	if(size > opts->chunk_size && !opts->check)
+	{
+		start_stream(c, job, data, size, &st, content_hash);
+		return true;
+	}
+
+	size_t num_processed = 0;
+	size_t new_size = size;
+	if(opts->check)
+		rewind(w->report);
+	w->sites.hashed = opts->cache_path && !opts->check ? &job->hashed : NULL;
+	bool ok = process_buffer(opts, w, path, data, size, &num_processed);
+	if(ok && opts->check)
+	{
+		job->num_mismatches = num_processed;
+		fflush(w->report);
+		if(num_processed > 0)
+			job->report = strndup(w->report_buffer, ftell(w->report));
+	}
+	else if(ok && num_processed > 0)
+	{
+		// The output still points into the mapping
+		Output *out = &w->out;
+		bool copy = st.st_nlink > 1;
+		char *target = output_target(path);
+		job->commit.temp = NULL;
+		if(!target)
+			ok = false;
+		else if(output_can_patch(out))
+			ok = output_patch_file(out, target, data, &st);
+		else if(opts->sync)
+		{
+			job->commit.temp = output_write_temp(out, target, &st);
+			ok = job->commit.temp != NULL;
+		}
+		else
+			ok = output_replace_file(out, target, &st);
+		job->has_commit = ok && opts->sync;
+		job->commit.path = target;
+		job->commit.copy = copy;
+		job->commit.dev = st.st_dev;
+		job->processed = ok;
+		new_size = output_size(out);
+		if(opts->cache_path)
+		{
+			CacheHasher h;
+			cache_hasher_init(&h, 0);
+			for(size_t i = 0; i < out->num_spans; ++i)
+				cache_hasher_update(&h, output_span_data(out, &out->spans[i]), out->spans[i].length);
+			content_hash = cache_hasher_final(&h);
+		}
+	}
+	munmap(data, size);
+	if(!ok)
+	{
+		return false;
+	}
+	set_record(job, new_size, cache_mtime(&st), content_hash);
+	return true;
+}
+
+static bool has_extension(Options *opts, const char *name)
+{
+	if(opts->num_extensions == 0)
+		return true;
+	size_t n = strlen(name);
+	for(int i = 0; i < opts->num_extensions; ++i)
+	{
+		size_t k = strlen(opts->extensions[i]);
+		if(n >= k && !strcmp(name + n - k, opts->extensions[i]))
+			return true;
+	}
+	return false;
+}
+
+static void submit_job(Context *c, JobType type, int input_index, char *path)
+{
+	Job *job = calloc(1, sizeof(Job));
+	arena_init(&job->hashed.text, 16 << 10);
+	job->type = type;
+	job->input_index = input_index;
+	job->path = path;
+
+	pthread_mutex_lock(&c->jobs_mutex);
+	if(c->num_jobs == c->max_jobs)
+	{
+		c->max_jobs = c->max_jobs ? c->max_jobs * 2 : 256;
+		c->jobs = realloc(c->jobs, c->max_jobs * sizeof(Job *));
+	}
+	c->jobs[c->num_jobs++] = job;
+	pthread_mutex_unlock(&c->jobs_mutex);
+
+	thread_pool_submit(&c->pool, job);
+}
+
+// Every directory is a task of its own, so the walk is spread over the same workers that process the files.
+// Files are handed to the pool as soon as they are found. Symbolic links and hidden entries are not followed.
+static bool walk_directory(Context *c, Job *job)
+{
+	DIR *dir = opendir(job->path);
+	if(!dir)
+		return false;
+	size_t n = strlen(job->path);
+	while(n > 1 && job->path[n - 1] == '/')
+		--n;
+	struct dirent *ent;
+	while((ent = readdir(dir)))
+	{
+		if(ent->d_name[0] == '.')
+			continue;
+		size_t k = strlen(ent->d_name);
+		char *path = malloc(n + k + 2);
+		memcpy(path, job->path, n);
+		path[n] = '/';
+		memcpy(path + n + 1, ent->d_name, k + 1);
+
+		int type = ent->d_type;
+		if(type == DT_UNKNOWN)
+		{
+			struct stat st;
+			if(lstat(path, &st) == -1)
+				type = DT_UNKNOWN;
+			else if(S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if(S_ISREG(st.st_mode))
+				type = DT_REG;
+		}
+		if(type == DT_DIR)
+		{
+			submit_job(c, JOB_TYPE_DIRECTORY, job->input_index, path);
+		}
+		else if(type == DT_REG && has_extension(c->opts, ent->d_name))
+		{
+			submit_job(c, JOB_TYPE_FILE, job->input_index, path);
+		}
+		else
+		{
+			free(path);
+		}
+	}
+	closedir(dir);
+	return true;
+}
+
+static void process_job(void *ctx, void *arg, int worker_index)
+{
+	Context *c = ctx;
+	Worker *w = &c->workers[worker_index];
+	Job *job = arg;
+	if(job->type == JOB_TYPE_CHUNK)
+	{
+		process_chunk_job(c, w, (StreamChunk *)job);
+		return;
+	}
+	rewind(w->log);
+	bool ok;
+	if(job->type == JOB_TYPE_DIRECTORY)
+		ok = walk_directory(c, job);
+	else
+		ok = process_source_file(c, w, job);
+	if(!ok)
+	{
+		job->failed = true;
+		fflush(w->log);
+		job->error = strndup(w->log_buffer, ftell(w->log));
+	}
+}
+
+static int job_compare(const void *a, const void *b)
+{
+	const Job *ja = *(const Job **)a;
+	const Job *jb = *(const Job **)b;
+	if(ja->input_index != jb->input_index)
+		return ja->input_index < jb->input_index ? -1 : 1;
+	return strcmp(ja->path, jb->path);
+}
+
+// Every string that was hashed in this run, see hgsym.h.
+static bool write_symbols(Options *opts)
+{
+	size_t count;
+	CollisionEntry **entries = collision_index_entries(&opts->collisions, &count);
+	HgSymSymbol *symbols = malloc((count ? count : 1) * sizeof(HgSymSymbol));
+	for(size_t i = 0; i < count; ++i)
+	{
+		symbols[i].hash[0] = entries[i]->hash[0];
+		symbols[i].hash[1] = entries[i]->hash[1];
+		symbols[i].string = entries[i]->string;
+		symbols[i].length = entries[i]->length;
+	}
+	bool ok = hgsym_write(opts->symbols_path, opts->hash->name, opts->hash->bits, symbols, count);
+	free(symbols);
+	free(entries);
+	return ok;
+}
+
+int main(int argc, const char **argv, char **envp)
+{
+	Options opts = { .hash = &hash_algorithms[0], .functions = NULL, .jobs = 1, .sync = true, .chunk_size = STREAM_CHUNK_SIZE };
+	opts.inputs = calloc(argc, sizeof(Input));
+	parse_opts(argc, argv, &opts);
+	collision_index_init(&opts.collisions);
+	if(opts.registry_path)
+	{
+		if(!registry_open(
+			   &opts.registry, opts.registry_path, lexer_hash(opts.hash->name, strlen(opts.hash->name)), !opts.check))
+		{
+			if(errno)
+				fprintf(stderr, "Failed to open registry '%s': %s\n", opts.registry_path, strerror(errno));
+			else
+				fprintf(stderr, "'%s' isn't a registry for %s\n", opts.registry_path, opts.hash->name);
+			exit(-1);
+		}
+	}
+	function_table_init(&opts.function_table, opts.functions);
+	matcher_init(&opts);
+	if(opts.cache_path)
+	{
+		opts.fingerprint = options_fingerprint(&opts);
+		cache_load(&opts.cache, opts.cache_path, opts.fingerprint);
+	}
+
+	if(opts.num_inputs == 0)
+	{
+		fprintf(stderr, "No input files.\n");
+		exit(-1);
+	}
+
+	Worker *workers = calloc(opts.jobs, sizeof(Worker));
+	for(int i = 0; i < opts.jobs; ++i)
+	{
+		Worker *w = &workers[i];
+		w->log = fmemopen(w->log_buffer, sizeof(w->log_buffer), "w");
+		if(opts.check)
+			w->report = open_memstream(&w->report_buffer, &w->report_size);
+		arena_init(&w->arena, 1 << 20);
+	}
+	Context c = { .opts = &opts, .workers = workers };
+	pthread_mutex_init(&c.jobs_mutex, NULL);
+	if(!thread_pool_init(&c.pool, opts.jobs, process_job, &c))
+	{
+		fprintf(stderr, "Failed to start worker threads.\n");
+		exit(-1);
+	}
+	for(int i = 0; i < opts.num_inputs; ++i)
+	{
+		Input *input = &opts.inputs[i];
+		submit_job(&c, input->recursive ? JOB_TYPE_DIRECTORY : JOB_TYPE_FILE, i, strdup(input->path));
+	}
+	thread_pool_wait(&c.pool);
+	thread_pool_destroy(&c.pool);
+
+	qsort(c.jobs, c.num_jobs, sizeof(Job *), job_compare);
+
+	OutputCommit *commits = malloc((c.num_jobs + 1) * sizeof(OutputCommit));
+	size_t num_commits = 0;
+	for(size_t i = 0; i < c.num_jobs; ++i)
+	{
+		if(c.jobs[i]->has_commit)
+			commits[num_commits++] = c.jobs[i]->commit;
+	}
+	output_commit(commits, num_commits);
+	for(size_t i = 0, j = 0; i < c.num_jobs; ++i)
+	{
+		Job *job = c.jobs[i];
+		if(!job->has_commit)
+			continue;
+		if(!commits[j++].ok)
+		{
+			job->failed = true;
+			job->processed = false;
+		}
+		free(job->commit.temp);
+	}
+	free(commits);
+	for(size_t i = 0; i < c.num_jobs; ++i)
+		free(c.jobs[i]->commit.path);
+	int num_failed = 0;
+	size_t num_mismatches = 0;
+	for(size_t i = 0; i < c.num_jobs; ++i)
+	{
+		Job *job = c.jobs[i];
+		if(job->processed)
+			printf("Processing: '%s'\n", job->path);
+		if(job->report)
+			fputs(job->report, stdout);
+		num_mismatches += job->num_mismatches;
+		if(job->failed)
+		{
+			if(job->error)
+				fputs(job->error, stderr);
+			fprintf(stderr, "Failed to process '%s'\n", job->path);
+			++num_failed;
+		}
+	}
+	size_t num_collisions = collision_index_report(&opts.collisions, opts.hash->bits, stderr);
+	// --check doesn't write symbols either, the registry was only opened for reading
+	if(opts.symbols_path && !opts.check && !write_symbols(&opts))
+	{
+		fprintf(stderr, "Failed to write symbols '%s'\n", opts.symbols_path);
+		++num_failed;
+	}
+	if(opts.check && num_mismatches > 0)
+		fprintf(stderr, "%zu hash literals don't match\n", num_mismatches);
+	// --check leaves the manifest alone as well
+	if(opts.cache_path && !opts.check)
+	{
+		CacheRecord *records = malloc((c.num_jobs + 1) * sizeof(CacheRecord));
+		size_t num_records = 0;
+		for(size_t i = 0; i < c.num_jobs; ++i)
+		{
+			if(c.jobs[i]->has_record && !c.jobs[i]->failed)
+				records[num_records++] = c.jobs[i]->record;
 		}
+		if(!cache_save(&opts.cache, opts.cache_path, opts.fingerprint, records, num_records))
+			fprintf(stderr, "Failed to save cache '%s'\n", opts.cache_path);
+		free(records);
 	}
-	return 0;
+	cache_free(&opts.cache);
+	aho_corasick_free(&opts.matcher);
+	collision_index_free(&opts.collisions);
+	registry_close(&opts.registry);
+	return num_failed > 0 || num_collisions > 0 || opts.num_conflicts > 0 || num_mismatches > 0 ? -1 : 0;
 }
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Output assembled from spans. Spans of the input are referenced in place, only text that is generated is stored
+// and the whole file is written with writev. If every piece of generated text is exactly as long as the input it
+// replaces, the original file can be patched in place instead.
+
+typedef struct
+{
+	const uint8_t *data; // NULL for generated text, which starts at offset in the text buffer
+	size_t offset;
+	size_t length;
+	const uint8_t *replaces; // Input the generated text takes the place of
+	size_t replaces_length;
+} OutputSpan;
+
+typedef struct
+{
+	OutputSpan *spans;
+	size_t num_spans, max_spans;
+	char *text;
+	size_t text_size, text_capacity;
+	struct iovec *iov;
+	size_t max_iov;
+} Output;
+
+static void output_reset(Output *out)
+{
+	out->num_spans = 0;
+	out->text_size = 0;
+}
+
+static void output_free(Output *out)
+{
+	free(out->spans);
+	free(out->text);
+	free(out->iov);
+	memset(out, 0, sizeof(Output));
+}
+
+static size_t output_size(const Output *out)
+{
+	size_t size = 0;
+	for(size_t i = 0; i < out->num_spans; ++i)
+		size += out->spans[i].length;
+	return size;
+}
+
+static OutputSpan *output_push_(Output *out)
+{
+	if(out->num_spans == out->max_spans)
+	{
+		out->max_spans = out->max_spans ? out->max_spans * 2 : 64;
+		out->spans = realloc(out->spans, out->max_spans * sizeof(OutputSpan));
+	}
+	return &out->spans[out->num_spans++];
+}
+
+// The data has to stay valid until the output is written.
+static void output_source(Output *out, const uint8_t *data, size_t length)
+{
+	if(length == 0)
+		return;
+	OutputSpan *last = out->num_spans ? &out->spans[out->num_spans - 1] : NULL;
+	if(last && last->data && last->data + last->length == data)
+	{
+		last->length += length;
+		last->replaces_length += length;
+		return;
+	}
+	OutputSpan *span = output_push_(out);
+	span->data = data;
+	span->offset = 0;
+	span->length = length;
+	span->replaces = data;
+	span->replaces_length = length;
+}
+
+// Generated text that takes the place of replaces_length bytes of the input at replaces.
+static void output_text(Output *out, const uint8_t *replaces, size_t replaces_length, const char *text, size_t length)
+{
+	if(out->text_size + length > out->text_capacity)
+	{
+		out->text_capacity = (out->text_size + length) * 2;
+		out->text = realloc(out->text, out->text_capacity);
+	}
+	memcpy(out->text + out->text_size, text, length);
+	OutputSpan *span = output_push_(out);
+	span->data = NULL;
+	span->offset = out->text_size;
+	span->length = length;
+	span->replaces = replaces;
+	span->replaces_length = replaces_length;
+	out->text_size += length;
+}
+
+static const uint8_t *output_span_data(const Output *out, const OutputSpan *span)
+{
+	return span->data ? span->data : (const uint8_t *)out->text + span->offset;
+}
+
+static bool output_writev(Output *out, int fd)
+{
+	if(out->max_iov < out->num_spans)
+	{
+		out->max_iov = out->num_spans;
+		out->iov = realloc(out->iov, out->max_iov * sizeof(struct iovec));
+	}
+	for(size_t i = 0; i < out->num_spans; ++i)
+	{
+		out->iov[i].iov_base = (void *)output_span_data(out, &out->spans[i]);
+		out->iov[i].iov_len = out->spans[i].length;
+	}
+	struct iovec *iov = out->iov;
+	size_t count = out->num_spans;
+	while(count > 0)
+	{
+		ssize_t n = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		// Skip what has been written, a short write can end in the middle of a span
+		while(count > 0 && (size_t)n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+// The file the output for path goes to. A symlink is followed, the link stays as it is and the file it points to
+// gets the output, the new file is created next to that one. Has to be freed, NULL on failure.
+static char *output_target(const char *path)
+{
+	return realpath(path, NULL);
+}
+
+// Creates an empty file next to the target with the same owner and permissions, *temp is set to its path which has
+// to be freed. Changing the owner takes privileges, without them the file belongs to this process. Extended
+// attributes and ACLs aren't copied. Returns the descriptor or -1 on failure.
+static int output_create_temp(const char *target, const struct stat *st, char **temp)
+{
+	size_t n = strlen(target);
+	const char *slash = strrchr(target, '/');
+	size_t dir_length = slash ? (size_t)(slash - target) + 1 : 0;
+	*temp = malloc(n + 16);
+	snprintf(*temp, n + 16, "%.*s.%s.hg-XXXXXX", (int)dir_length, target, target + dir_length);
+	int fd = mkstemp(*temp);
+	// The owner first, changing it may clear the set-user-ID and set-group-ID bits
+	if(fd != -1 && fchown(fd, st->st_uid, st->st_gid) && errno != EPERM)
+	{
+		close(fd);
+		unlink(*temp);
+		fd = -1;
+	}
+	if(fd != -1 && fchmod(fd, st->st_mode & 07777))
+	{
+		close(fd);
+		unlink(*temp);
+		fd = -1;
+	}
+	if(fd == -1)
+	{
+		free(*temp);
+		*temp = NULL;
+	}
+	return fd;
+}
+
+// Writes the output to a new file next to the target, so the spans may still point into a mapping of the
+// original. The permissions of the original are kept, st is updated with the status of the new file.
+// Returns the path of the new file, which has to be freed, or NULL on failure.
+static char *output_write_temp(Output *out, const char *target, struct stat *st)
+{
+	char *temp;
+	int fd = output_create_temp(target, st, &temp);
+	if(fd == -1)
+		return NULL;
+	bool ok = output_writev(out, fd) && !fstat(fd, st);
+	ok = !close(fd) && ok;
+	if(!ok)
+	{
+		unlink(temp);
+		free(temp);
+		return NULL;
+	}
+	return temp;
+}
+
+static bool output_write_all_(int fd, const char *data, size_t n)
+{
+	while(n > 0)
+	{
+		ssize_t k = write(fd, data, n);
+		if(k < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return false;
+		}
+		data += k;
+		n -= k;
+	}
+	return true;
+}
+
+// Overwrites target with the contents of temp, it keeps its inode and with it its other hard links. Unlike a rename
+// that isn't atomic.
+static bool output_copy_over_(const char *temp, const char *target, struct stat *st)
+{
+	int in = open(temp, O_RDONLY);
+	if(in == -1)
+		return false;
+	int fd = open(target, O_WRONLY | O_TRUNC);
+	bool ok = fd != -1;
+	char buffer[64 << 10];
+	while(ok)
+	{
+		ssize_t n = read(in, buffer, sizeof(buffer));
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+		{
+			ok = n == 0;
+			break;
+		}
+		ok = output_write_all_(fd, buffer, n);
+	}
+	close(in);
+	if(fd != -1)
+	{
+		ok = !fstat(fd, st) && ok;
+		ok = !close(fd) && ok;
+	}
+	return ok;
+}
+
+// Puts the new file in place of the target and removes it. With copy, for a file with more than one hard link that
+// a rename would split off from its other links, it's copied over the target instead. st is updated with the status
+// of the file that is in place.
+static bool output_install(const char *temp, const char *target, bool copy, struct stat *st)
+{
+	bool ok = copy ? output_copy_over_(temp, target, st) : !rename(temp, target);
+	if(copy || !ok)
+		unlink(temp);
+	return ok;
+}
+
+// The target is only replaced once the new file is complete, a process that gets killed halfway leaves it as it
+// was. target has to come from output_target, st is the status of the original. Not durable, see output_commit.
+static bool output_replace_file(Output *out, const char *target, struct stat *st)
+{
+	bool copy = st->st_nlink > 1;
+	char *temp = output_write_temp(out, target, st);
+	if(!temp)
+		return false;
+	bool ok = output_install(temp, target, copy, st);
+	free(temp);
+	return ok;
+}
+
+// A file that has been written but isn't in place yet.
+typedef struct
+{
+	char *temp; // NULL if the file was patched in place, it only has to be flushed
+	char *path; // From output_target
+	bool copy;	// See output_install
+	dev_t dev;
+	bool ok;
+} OutputCommit;
+
+// Flushes every file system that one of the files lives on once, instead of calling fsync for every file.
+static void output_sync_file_systems_(OutputCommit *commits, size_t num_commits, bool temp)
+{
+	dev_t *synced = malloc((num_commits ? num_commits : 1) * sizeof(dev_t));
+	size_t num_synced = 0;
+	for(size_t i = 0; i < num_commits; ++i)
+	{
+		OutputCommit *c = &commits[i];
+		if(!c->ok)
+			continue;
+		bool seen = false;
+		for(size_t j = 0; j < num_synced && !seen; ++j)
+			seen = synced[j] == c->dev;
+		if(seen)
+			continue;
+		int fd = open(temp && c->temp ? c->temp : c->path, O_RDONLY);
+		if(fd == -1)
+			continue;
+#if defined(__linux__)
+		bool ok = !syncfs(fd);
+#else
+		bool ok = !fsync(fd);
+#endif
+		close(fd);
+		if(ok)
+			synced[num_synced++] = c->dev;
+		else
+			c->ok = false;
+	}
+	free(synced);
+}
+
+// Group commit: the contents of all new files are flushed, then they're put in place of the targets and finally
+// that is flushed. After a crash every file is either the old or the new version, never a truncated one, except for
+// files with hard links, which are copied over.
+static void output_commit(OutputCommit *commits, size_t num_commits)
+{
+	for(size_t i = 0; i < num_commits; ++i)
+		commits[i].ok = true;
+	output_sync_file_systems_(commits, num_commits, true);
+	for(size_t i = 0; i < num_commits; ++i)
+	{
+		OutputCommit *c = &commits[i];
+		if(!c->temp)
+			continue;
+		struct stat st;
+		if(!c->ok)
+			unlink(c->temp);
+		else if(!output_install(c->temp, c->path, c->copy, &st))
+			c->ok = false;
+	}
+	output_sync_file_systems_(commits, num_commits, false);
+}
+
+static bool output_can_patch(const Output *out)
+{
+	for(size_t i = 0; i < out->num_spans; ++i)
+	{
+		if(out->spans[i].length != out->spans[i].replaces_length)
+			return false;
+	}
+	return true;
+}
+
+// Writes only the bytes that differ from the input with pwrite, base is where the original file is mapped.
+// Leaves the inode and every page that isn't touched alone. Only valid if output_can_patch.
+static bool output_patch_file(Output *out, const char *path, const uint8_t *base, struct stat *st)
+{
+	int fd = open(path, O_WRONLY);
+	if(fd == -1)
+		return false;
+	bool ok = true;
+	for(size_t i = 0; i < out->num_spans && ok; ++i)
+	{
+		const OutputSpan *span = &out->spans[i];
+		if(span->data)
+			continue;
+		const uint8_t *text = (const uint8_t *)out->text + span->offset;
+		size_t first = 0, last = span->length;
+		while(first < last && text[first] == span->replaces[first])
+			++first;
+		while(last > first && text[last - 1] == span->replaces[last - 1])
+			--last;
+		if(first == last)
+			continue;
+		off_t offset = span->replaces - base + first;
+		size_t n = last - first;
+		while(n > 0)
+		{
+			ssize_t k = pwrite(fd, text + first, n, offset);
+			if(k < 0)
+			{
+				if(errno == EINTR)
+					continue;
+				ok = false;
+				break;
+			}
+			first += k;
+			offset += k;
+			n -= k;
+		}
+	}
+	ok = !fstat(fd, st) && ok;
+	ok = !close(fd) && ok;
+	return ok;
+}
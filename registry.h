@@ -0,0 +1,221 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Hash table in a shared file that any number of hg processes insert into at the same time, so a collision is
+// noticed even when the strings are processed by different processes. Nothing is locked once the file exists:
+//
+//   RegistryHeader
+//   uint64_t slots[capacity]   open addressing, linear probing
+//   char text[text_size]       RegistryRecord, the string, then its location \0 terminated
+//
+// A process writes the whole record into text it allocated for itself, nobody else looks at it yet, and publishes
+// it with a compare and swap of an empty slot to the record's offset. A slot is either empty or points at a
+// complete record, a process that dies or is stopped while inserting leaves nothing half written and nobody waits
+// for it. If another record is published in the slot first, that record is compared and the next slot is tried.
+// Records carry a random id of the process that wrote them, pids are reused and aren't unique across PID
+// namespaces that share the file. Slots are never removed, delete the file to start over.
+
+#define REGISTRY_MAGIC "HGR1"
+#define REGISTRY_VERSION 2
+#define REGISTRY_CAPACITY (1 << 20)
+#define REGISTRY_TEXT_SIZE (64 << 20)
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t fingerprint; // Of the hash algorithm, every process has to use the same one
+	uint64_t capacity;
+	uint64_t text_size;
+	uint64_t text_used; // Atomic
+} RegistryHeader;
+
+// Followed by the string and its location, records start at multiples of 8 in the text
+typedef struct
+{
+	uint64_t hash[2];
+	uint64_t writer; // Random id of the process that inserted it
+	uint32_t pid;	 // Of that process, only to tell the user
+	uint32_t length;
+} RegistryRecord;
+
+typedef struct
+{
+	void *map;
+	size_t map_size;
+	RegistryHeader *header;
+	uint64_t *slots; // Atomic, 0 if empty, 1 + the offset of a RegistryRecord in the text otherwise
+	char *text;
+	uint64_t writer;
+	bool writable; // Otherwise strings are only looked up
+} Registry;
+
+typedef enum
+{
+	REGISTRY_ADDED,
+	REGISTRY_PRESENT,  // The same string is in the registry already
+	REGISTRY_CONFLICT, // Another string with the same hash is in the registry, see RegistryConflict. The string
+					   // itself may or may not be in the registry.
+	REGISTRY_FULL,
+	REGISTRY_ABSENT // Not in a registry that is only open for reading
+} RegistryResult;
+
+typedef struct
+{
+	const char *string;
+	size_t length;
+	const char *location;
+	uint64_t writer; // Id of the process that inserted it, Registry.writer
+	int pid;
+} RegistryConflict;
+
+// A file name without a directory is created in /dev/shm. Without writable the file has to exist already and is
+// only read. Returns false with errno set or 0 if the file isn't a registry for the same hash algorithm.
+static bool registry_open(Registry *r, const char *name, uint64_t fingerprint, bool writable)
+{
+	memset(r, 0, sizeof(Registry));
+	char path[4096];
+	if(strchr(name, '/'))
+		snprintf(path, sizeof(path), "%s", name);
+	else
+		snprintf(path, sizeof(path), "/dev/shm/%s", name);
+	int fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0666);
+	if(fd == -1)
+		return false;
+	size_t size = sizeof(RegistryHeader) + REGISTRY_CAPACITY * sizeof(uint64_t) + REGISTRY_TEXT_SIZE;
+	// Only creating the file is locked, the processes that come later wait until the header is written. A file
+	// without a header was left behind by a process that died while creating it.
+	struct stat st;
+	RegistryHeader existing = { 0 };
+	bool ok = !flock(fd, writable ? LOCK_EX : LOCK_SH) && !fstat(fd, &st) &&
+			  pread(fd, &existing, sizeof(existing), 0) >= 0;
+	if(ok && writable && (st.st_size == 0 || !memcmp(existing.magic, "\0\0\0\0", 4)))
+	{
+		RegistryHeader header = { REGISTRY_MAGIC, REGISTRY_VERSION, fingerprint, REGISTRY_CAPACITY, REGISTRY_TEXT_SIZE, 0 };
+		ok = !ftruncate(fd, size) && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+		st.st_size = size;
+	}
+	flock(fd, LOCK_UN);
+	if(ok && (size_t)st.st_size < sizeof(RegistryHeader))
+	{
+		close(fd);
+		errno = 0;
+		return false;
+	}
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void *map = ok ? mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(map == MAP_FAILED)
+		return false;
+	RegistryHeader *header = map;
+	if(memcmp(header->magic, REGISTRY_MAGIC, 4) ||
+	   header->version != REGISTRY_VERSION || header->fingerprint != fingerprint ||
+	   (header->capacity & (header->capacity - 1)) ||
+	   sizeof(RegistryHeader) + header->capacity * sizeof(uint64_t) + header->text_size != (size_t)st.st_size)
+	{
+		munmap(map, st.st_size);
+		errno = 0;
+		return false;
+	}
+	r->map = map;
+	r->map_size = st.st_size;
+	r->header = header;
+	r->slots = (uint64_t *)(header + 1);
+	r->text = (char *)(r->slots + header->capacity);
+	r->writable = writable;
+	if(getrandom(&r->writer, sizeof(r->writer), 0) != sizeof(r->writer))
+		r->writer = (uint64_t)getpid() << 32 ^ (uint64_t)time(NULL) ^ (uintptr_t)r;
+	return true;
+}
+
+static void registry_close(Registry *r)
+{
+	if(r->map)
+		munmap(r->map, r->map_size);
+	memset(r, 0, sizeof(Registry));
+}
+
+// Space for a record, or -1 if the registry is full.
+static int64_t registry_alloc_text_(Registry *r, size_t size)
+{
+	size = (size + 7) & ~(size_t)7;
+	uint64_t offset = __atomic_fetch_add(&r->header->text_used, size, __ATOMIC_RELAXED);
+	if(offset + size > r->header->text_size)
+		return -1;
+	return offset;
+}
+
+// mixed picks the first slot, it has to be the same for a hash in every process. A string that is already in the
+// registry is still compared with the rest of the strings that share its first slot, so a conflict is reported
+// every time, not only by the process that inserted the second string. A registry that is only open for reading is
+// searched the same way and nothing is inserted.
+static RegistryResult registry_insert(Registry *r,
+									  const uint64_t hash[2],
+									  uint64_t mixed,
+									  const char *string,
+									  size_t length,
+									  const char *location,
+									  RegistryConflict *conflict)
+{
+	size_t location_length = strlen(location);
+	int64_t offset = -1; // Written once an empty slot is found, kept if another record is published there first
+	bool conflicts = false, present = false;
+	size_t mask = r->header->capacity - 1;
+	for(size_t i = 0, k = mixed & mask; i <= mask; ++i, k = (k + 1) & mask)
+	{
+		uint64_t published = __atomic_load_n(&r->slots[k], __ATOMIC_ACQUIRE);
+		while(!published)
+		{
+			if(present || !r->writable)
+				return conflicts ? REGISTRY_CONFLICT : present ? REGISTRY_PRESENT : REGISTRY_ABSENT;
+			if(offset == -1)
+			{
+				if((offset = registry_alloc_text_(r, sizeof(RegistryRecord) + length + location_length + 1)) == -1)
+					return REGISTRY_FULL;
+				RegistryRecord *record = (RegistryRecord *)(r->text + offset);
+				record->hash[0] = hash[0];
+				record->hash[1] = hash[1];
+				record->writer = r->writer;
+				record->pid = getpid();
+				record->length = length;
+				memcpy(record + 1, string, length);
+				memcpy((char *)(record + 1) + length, location, location_length + 1);
+			}
+			// On failure published is the record that was first, it's compared like any other
+			if(__atomic_compare_exchange_n(
+				   &r->slots[k], &published, (uint64_t)offset + 1, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+				return conflicts ? REGISTRY_CONFLICT : REGISTRY_ADDED;
+		}
+		const RegistryRecord *other = (const RegistryRecord *)(r->text + published - 1);
+		if(other->hash[0] != hash[0] || other->hash[1] != hash[1])
+			continue;
+		const char *text = (const char *)(other + 1);
+		if(other->length == length && !memcmp(text, string, length))
+			present = true;
+		else if(!conflicts)
+		{
+			conflicts = true;
+			conflict->string = text;
+			conflict->length = other->length;
+			conflict->location = text + other->length;
+			conflict->writer = other->writer;
+			conflict->pid = other->pid;
+		}
+	}
+	if(present)
+		return conflicts ? REGISTRY_CONFLICT : REGISTRY_PRESENT;
+	return REGISTRY_FULL;
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+// Kernels that skip over the bulk of comments, strings and whitespace 16 or 32 bytes at a time. Each returns the
+// first byte in [p, end) that the caller has to look at, or end. AVX2 is used if the CPU has it, SSE2 otherwise,
+// plain loops on anything else. Both are compiled with a target attribute, they only run when the CPU has them.
+//
+//   scan_comment     '*' or \0, candidates for the end of a block comment
+//   scan_string      '"' '\' \n or \0
+//   scan_line        \r \n or \0, the end of a line comment
+//   scan_code        '"' '/' or \0, where a string or comment may start
+//   scan_blank       anything but space \t \r
+//   scan_whitespace  anything but space \t \r \n
+
+typedef const uint8_t *(*ScanFunction)(const uint8_t *p, const uint8_t *end);
+
+typedef struct
+{
+	ScanFunction comment;
+	ScanFunction string;
+	ScanFunction line;
+	ScanFunction code;
+	ScanFunction blank;
+	ScanFunction whitespace;
+} ScanKernels;
+
+// Up to four characters to look for, unused slots repeat one of the others. If negate is set the kernel looks for
+// the first byte that is none of them instead.
+#define SCAN_SCALAR_(name, a, b, c, d, negate)                                                                         \
+	static const uint8_t *name(const uint8_t *p, const uint8_t *end)                                                   \
+	{                                                                                                                  \
+		while(p < end && ((*p == (a) || *p == (b) || *p == (c) || *p == (d)) == (negate)))                             \
+			++p;                                                                                                       \
+		return p;                                                                                                      \
+	}
+
+SCAN_SCALAR_(scan_comment_scalar_, '*', 0, 0, 0, false)
+SCAN_SCALAR_(scan_string_scalar_, '"', '\\', '\n', 0, false)
+SCAN_SCALAR_(scan_line_scalar_, '\r', '\n', 0, 0, false)
+SCAN_SCALAR_(scan_code_scalar_, '"', '/', 0, 0, false)
+SCAN_SCALAR_(scan_blank_scalar_, ' ', '\t', '\r', '\r', true)
+SCAN_SCALAR_(scan_whitespace_scalar_, ' ', '\t', '\r', '\n', true)
+
+#ifdef SCAN_X86
+
+#define SCAN_SSE2_(name, a, b, c, d, negate)                                                                           \
+	__attribute__((target("sse2"))) static const uint8_t *name(const uint8_t *p, const uint8_t *end)                   \
+	{                                                                                                                  \
+		const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);      \
+		for(; end - p >= 16; p += 16)                                                                                  \
+		{                                                                                                              \
+			__m128i v = _mm_loadu_si128((const __m128i *)p);                                                           \
+			__m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),                      \
+									  _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));                     \
+			uint32_t mask = _mm_movemask_epi8(eq);                                                                     \
+			if(negate)                                                                                                 \
+				mask ^= 0xffff;                                                                                        \
+			if(mask)                                                                                                   \
+				return p + __builtin_ctz(mask);                                                                        \
+		}                                                                                                              \
+		while(p < end && ((*p == (a) || *p == (b) || *p == (c) || *p == (d)) == (negate)))                             \
+			++p;                                                                                                       \
+		return p;                                                                                                      \
+	}
+
+#define SCAN_AVX2_(name, a, b, c, d, negate)                                                                           \
+	__attribute__((target("avx2"))) static const uint8_t *name(const uint8_t *p, const uint8_t *end)                   \
+	{                                                                                                                  \
+		const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);                                              \
+		const __m256i vc = _mm256_set1_epi8(c), vd = _mm256_set1_epi8(d);                                              \
+		for(; end - p >= 32; p += 32)                                                                                  \
+		{                                                                                                              \
+			__m256i v = _mm256_loadu_si256((const __m256i *)p);                                                        \
+			__m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),          \
+										 _mm256_or_si256(_mm256_cmpeq_epi8(v, vc), _mm256_cmpeq_epi8(v, vd)));         \
+			uint32_t mask = _mm256_movemask_epi8(eq);                                                                  \
+			if(negate)                                                                                                 \
+				mask = ~mask;                                                                                          \
+			if(mask)                                                                                                   \
+				return p + __builtin_ctz(mask);                                                                        \
+		}                                                                                                              \
+		while(p < end && ((*p == (a) || *p == (b) || *p == (c) || *p == (d)) == (negate)))                             \
+			++p;                                                                                                       \
+		return p;                                                                                                      \
+	}
+
+SCAN_SSE2_(scan_comment_sse2_, '*', 0, 0, 0, false)
+SCAN_SSE2_(scan_string_sse2_, '"', '\\', '\n', 0, false)
+SCAN_SSE2_(scan_line_sse2_, '\r', '\n', 0, 0, false)
+SCAN_SSE2_(scan_code_sse2_, '"', '/', 0, 0, false)
+SCAN_SSE2_(scan_blank_sse2_, ' ', '\t', '\r', '\r', true)
+SCAN_SSE2_(scan_whitespace_sse2_, ' ', '\t', '\r', '\n', true)
+
+SCAN_AVX2_(scan_comment_avx2_, '*', 0, 0, 0, false)
+SCAN_AVX2_(scan_string_avx2_, '"', '\\', '\n', 0, false)
+SCAN_AVX2_(scan_line_avx2_, '\r', '\n', 0, 0, false)
+SCAN_AVX2_(scan_code_avx2_, '"', '/', 0, 0, false)
+SCAN_AVX2_(scan_blank_avx2_, ' ', '\t', '\r', '\r', true)
+SCAN_AVX2_(scan_whitespace_avx2_, ' ', '\t', '\r', '\n', true)
+
+#endif
+
+static ScanKernels scan_kernels_ = {
+	scan_comment_scalar_, scan_string_scalar_, scan_line_scalar_,
+	scan_code_scalar_,	  scan_blank_scalar_,  scan_whitespace_scalar_,
+};
+
+// Picks the kernels before main runs, so they're set before any thread could use them.
+__attribute__((constructor)) static void scan_init_(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		ScanKernels k = { scan_comment_avx2_, scan_string_avx2_, scan_line_avx2_,
+						  scan_code_avx2_,	  scan_blank_avx2_,	 scan_whitespace_avx2_ };
+		scan_kernels_ = k;
+	}
+	else if(__builtin_cpu_supports("sse2"))
+	{
+		ScanKernels k = { scan_comment_sse2_, scan_string_sse2_, scan_line_sse2_,
+						  scan_code_sse2_,	  scan_blank_sse2_,	 scan_whitespace_sse2_ };
+		scan_kernels_ = k;
+	}
+#endif
+}
+
+static inline const uint8_t *scan_comment(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.comment(p, end);
+}
+
+static inline const uint8_t *scan_string(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.string(p, end);
+}
+
+static inline const uint8_t *scan_line(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.line(p, end);
+}
+
+static inline const uint8_t *scan_code(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.code(p, end);
+}
+
+static inline const uint8_t *scan_blank(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.blank(p, end);
+}
+
+static inline const uint8_t *scan_whitespace(const uint8_t *p, const uint8_t *end)
+{
+	return scan_kernels_.whitespace(p, end);
+}
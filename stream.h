@@ -2,7 +2,6 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdarg.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -26,6 +25,9 @@ typedef struct Stream_s
 	size_t (*read)(struct Stream_s *stream, void *ptr, size_t size, size_t nmemb);
 	/* void (*close)(struct Stream_s *stream); */
 	size_t (*write)(struct Stream_s *stream, const void *ptr, size_t size, size_t nmemb);
+	/* Optional, for streams that are backed by memory. Returns zero and exposes the buffer and the stream's offset into
+	 * it, so readers can walk the buffer directly instead of going through read, tell and seek. */
+	int (*memory)(struct Stream_s *stream, const uint8_t **buffer, size_t *length, size_t **offset);
 } Stream;
 
 static size_t stream_read_buffer(Stream *s, void *ptr, size_t n)
@@ -135,20 +137,6 @@ static void stream_print(Stream *s, const char *text)
 	stream_unget(s);
 }
 
-static void stream_printf(Stream *s, const char *fmt, ...)
-{
-	char text[2048] = { 0 };
-	if(fmt)
-	{
-		va_list va;
-		va_start(va, fmt);
-		vsnprintf(text, sizeof(text), fmt, va);
-		va_end(va);
-	}
-	s->write(s, text, 1, strlen(text) + 1);
-	stream_unget(s);
-}
-
 static void stream_skip_characters(Stream *s, const char *chars)
 {
 	while(1)
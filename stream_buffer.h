@@ -37,7 +37,8 @@ static size_t stream_write_buffer_(struct Stream_s *stream, const void *ptr, siz
 			/* printf("overflow offset:%d,nb:%d,length:%d,size:%d,nmemb:%d\n",sd->offset,nb,sd->length,size,nmemb); */
 			return 0; // EOF
 		}
-		sd->grow(sd, sd->offset + nb);
+		if(!sd->grow(sd, sd->offset + nb))
+			return 0;
 	}
 	memcpy(&sd->buffer[sd->offset], ptr, nb);
 	/* printf("writing %d (%d/%d)\n", nb, sd->offset, sd->length); */
@@ -94,6 +95,15 @@ static int stream_seek_buffer_(struct Stream_s *s, int64_t offset, int whence)
 	return 0;
 }
 
+static int stream_memory_buffer_(struct Stream_s *s, const uint8_t **buffer, size_t *length, size_t **offset)
+{
+	StreamBuffer *sd = (StreamBuffer *)s->ctx;
+	*buffer = sd->buffer;
+	*length = sd->length;
+	*offset = &sd->offset;
+	return 0;
+}
+
 static int init_stream_from_stream_buffer(Stream *s, StreamBuffer *sb)
 {
 	s->ctx = sb;
@@ -103,6 +113,7 @@ static int init_stream_from_stream_buffer(Stream *s, StreamBuffer *sb)
 	s->name = stream_name_buffer_;
 	s->tell = stream_tell_buffer_;
 	s->seek = stream_seek_buffer_;
+	s->memory = stream_memory_buffer_;
 	return 0;
 }
 
@@ -121,11 +132,16 @@ static int init_stream_from_buffer(Stream *s, StreamBuffer *sb, unsigned char *b
 	s->name = stream_name_buffer_;
 	s->tell = stream_tell_buffer_;
 	s->seek = stream_seek_buffer_;
+	s->memory = stream_memory_buffer_;
 	return 0;
 }
 
 static bool stream_buffer_buffer_grow_realloc(struct StreamBuffer_s *sb, size_t size)
 {
-	sb->buffer = realloc(sb->buffer, size * 2);
+	unsigned char *buffer = realloc(sb->buffer, size * 2);
+	if(!buffer)
+		return false;
+	sb->buffer = buffer;
 	sb->length = size * 2;
+	return true;
 }
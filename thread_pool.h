@@ -0,0 +1,221 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Work-stealing thread pool.
+// Every worker owns a deque, it pushes and pops work at the back (LIFO) and steals from the front of the other
+// workers' deques (FIFO) when its own runs dry. Tasks submitted from outside of the pool are spread round-robin.
+
+typedef void (*ThreadPoolTask)(void *ctx, void *arg, int worker_index);
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+	void **items;
+	size_t head, count, capacity;
+} ThreadPoolDeque;
+
+typedef struct ThreadPool_s
+{
+	ThreadPoolTask task;
+	void *ctx;
+	int num_workers;
+	pthread_t *threads;
+	ThreadPoolDeque *deques;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+	long queued;  // Tasks sitting in a deque
+	long pending; // Tasks submitted, but not finished yet
+	unsigned next;
+	bool stop;
+} ThreadPool;
+
+typedef struct
+{
+	ThreadPool *pool;
+	int worker_index;
+} ThreadPoolWorker_;
+
+static __thread ThreadPoolWorker_ thread_pool_current_;
+
+static void thread_pool_deque_push_(ThreadPoolDeque *d, void *item)
+{
+	pthread_mutex_lock(&d->mutex);
+	if(d->count == d->capacity)
+	{
+		size_t capacity = d->capacity ? d->capacity * 2 : 64;
+		void **items = malloc(capacity * sizeof(void *));
+		for(size_t i = 0; i < d->count; ++i)
+			items[i] = d->items[(d->head + i) % d->capacity];
+		free(d->items);
+		d->items = items;
+		d->head = 0;
+		d->capacity = capacity;
+	}
+	d->items[(d->head + d->count) % d->capacity] = item;
+	d->count++;
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static bool thread_pool_deque_pop_back_(ThreadPoolDeque *d, void **item)
+{
+	bool ok = false;
+	pthread_mutex_lock(&d->mutex);
+	if(d->count > 0)
+	{
+		d->count--;
+		*item = d->items[(d->head + d->count) % d->capacity];
+		ok = true;
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return ok;
+}
+
+static bool thread_pool_deque_pop_front_(ThreadPoolDeque *d, void **item)
+{
+	bool ok = false;
+	pthread_mutex_lock(&d->mutex);
+	if(d->count > 0)
+	{
+		*item = d->items[d->head];
+		d->head = (d->head + 1) % d->capacity;
+		d->count--;
+		ok = true;
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return ok;
+}
+
+static bool thread_pool_take_(ThreadPool *pool, int worker_index, void **item)
+{
+	if(thread_pool_deque_pop_back_(&pool->deques[worker_index], item))
+		return true;
+	for(int i = 1; i < pool->num_workers; ++i)
+	{
+		int victim = (worker_index + i) % pool->num_workers;
+		if(thread_pool_deque_pop_front_(&pool->deques[victim], item))
+			return true;
+	}
+	return false;
+}
+
+static void *thread_pool_worker_(void *arg)
+{
+	ThreadPoolWorker_ *worker = arg;
+	ThreadPool *pool = worker->pool;
+	thread_pool_current_ = *worker;
+	while(1)
+	{
+		void *item;
+		if(thread_pool_take_(pool, worker->worker_index, &item))
+		{
+			pthread_mutex_lock(&pool->mutex);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->mutex);
+
+			pool->task(pool->ctx, item, worker->worker_index);
+
+			pthread_mutex_lock(&pool->mutex);
+			if(--pool->pending == 0)
+				pthread_cond_broadcast(&pool->work_done);
+			pthread_mutex_unlock(&pool->mutex);
+			continue;
+		}
+		pthread_mutex_lock(&pool->mutex);
+		while(pool->queued <= 0 && !pool->stop)
+			pthread_cond_wait(&pool->work_available, &pool->mutex);
+		bool stop = pool->stop && pool->queued <= 0;
+		pthread_mutex_unlock(&pool->mutex);
+		if(stop)
+			break;
+	}
+	free(worker);
+	return NULL;
+}
+
+static bool thread_pool_init(ThreadPool *pool, int num_workers, ThreadPoolTask task, void *ctx)
+{
+	if(num_workers < 1)
+		num_workers = 1;
+	pool->task = task;
+	pool->ctx = ctx;
+	pool->num_workers = num_workers;
+	pool->queued = 0;
+	pool->pending = 0;
+	pool->next = 0;
+	pool->stop = false;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+	pool->deques = calloc(num_workers, sizeof(ThreadPoolDeque));
+	pool->threads = calloc(num_workers, sizeof(pthread_t));
+	for(int i = 0; i < num_workers; ++i)
+		pthread_mutex_init(&pool->deques[i].mutex, NULL);
+	for(int i = 0; i < num_workers; ++i)
+	{
+		ThreadPoolWorker_ *worker = malloc(sizeof(ThreadPoolWorker_));
+		worker->pool = pool;
+		worker->worker_index = i;
+		if(pthread_create(&pool->threads[i], NULL, thread_pool_worker_, worker))
+		{
+			free(worker);
+			pool->num_workers = i;
+			break;
+		}
+	}
+	return pool->num_workers > 0;
+}
+
+// Can be called from any thread, including the pool's own workers while they're running a task.
+static void thread_pool_submit(ThreadPool *pool, void *arg)
+{
+	int worker_index;
+	pthread_mutex_lock(&pool->mutex);
+	pool->pending++;
+	if(thread_pool_current_.pool == pool)
+		worker_index = thread_pool_current_.worker_index;
+	else
+		worker_index = pool->next++ % pool->num_workers;
+	pthread_mutex_unlock(&pool->mutex);
+
+	thread_pool_deque_push_(&pool->deques[worker_index], arg);
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->queued++;
+	pthread_cond_signal(&pool->work_available);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+// Blocks until every submitted task, including the ones submitted by tasks, has finished.
+static void thread_pool_wait(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->pending > 0)
+		pthread_cond_wait(&pool->work_done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void thread_pool_destroy(ThreadPool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->mutex);
+	for(int i = 0; i < pool->num_workers; ++i)
+		pthread_join(pool->threads[i], NULL);
+	for(int i = 0; i < pool->num_workers; ++i)
+	{
+		pthread_mutex_destroy(&pool->deques[i].mutex);
+		free(pool->deques[i].items);
+	}
+	free(pool->deques);
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_cond_destroy(&pool->work_done);
+}